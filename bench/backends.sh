@@ -0,0 +1,67 @@
+#!/bin/sh
+# Compare execution backends on one program, fib(40) by default.
+#
+#   backends.sh <kaleidoscopec> [source]
+#
+# Runs the program through the evaluator (--eval) and as a native
+# executable from the C backend (--emit-exe), next to bench/fib.c compiled
+# the same way as a hand-written reference when its output agrees. Wall
+# times include process start-up; the AOT compile time is reported
+# separately.
+#
+# Environment:
+#   RUNS    samples per backend; the median is reported (default: 3)
+#   CC      C compiler for --emit-exe and the reference (default: cc)
+set -eu
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <kaleidoscopec> [source]" >&2
+    exit 1
+fi
+driver=$1
+benchdir=$(cd "$(dirname "$0")" && pwd)
+source=${2:-$benchdir/../kaleidoscope-c/source.txt}
+RUNS=${RUNS:-3}
+CC=${CC:-cc}
+export CC
+
+mkdir -p "$benchdir/build"
+aot=$benchdir/build/backend-aot
+reference=$benchdir/build/backend-reference
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+# Median wall time in ms of RUNS runs of the command; checks its output.
+measure() {
+    expected=$1
+    shift
+    times=""
+    i=0
+    while [ "$i" -lt "$RUNS" ]; do
+        start=$(now_ms)
+        out=$("$@")
+        times="$times $(($(now_ms) - start))"
+        if [ "$out" != "$expected" ]; then
+            echo "output mismatch: $*" >&2
+            exit 1
+        fi
+        i=$((i + 1))
+    done
+    echo $times | tr ' ' '\n' | sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+start=$(now_ms)
+"$driver" --emit-exe -o "$aot" "$source"
+aotCompile=$(($(now_ms) - start))
+"$CC" -O2 -o "$reference" "$benchdir/fib.c"
+expected=$("$aot")
+
+printf '%-12s %10s\n' backend "median ms"
+# fib.c only stands in for the default program.
+if [ "$("$reference")" = "$expected" ]; then
+    printf '%-12s %10s\n' reference "$(measure "$expected" "$reference")"
+fi
+printf '%-12s %10s   (+%s ms to compile)\n' aot "$(measure "$expected" "$aot")" "$aotCompile"
+printf '%-12s %10s\n' eval "$(measure "$expected" "$driver" --eval "$source")"
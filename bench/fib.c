@@ -0,0 +1,11 @@
+// Hand-written reference for source.txt: what the C backend should match.
+#include <stdio.h>
+
+static double fib(double x) {
+    return x < 3 ? 1 : fib(x - 1) + fib(x - 2);
+}
+
+int main(void) {
+    printf("%f\n", fib(40));
+    return 0;
+}
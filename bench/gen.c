@@ -0,0 +1,207 @@
+// Deterministic synthetic corpus generator for the benchmark suite.
+//
+//   gen <shape> <size> [seed]
+//
+// Writes roughly <size> bytes (suffixes K, M, G) of Kaleidoscope source of
+// the given shape to stdout. The same arguments always produce the same
+// bytes. Every corpus lexes, parses and evaluates cleanly in both frontends:
+// no recursion, no if/then/else, and only calls to earlier definitions.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t state;
+    uint64_t written;
+    unsigned defs;
+} Gen;
+
+static uint64_t next_rand(Gen* g) {
+    // xorshift64*
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return g->state * 2685821657736338717ull;
+}
+
+static unsigned rand_below(Gen* g, unsigned n) {
+    return (unsigned)(next_rand(g) % n);
+}
+
+__attribute__((format(printf, 2, 3))) static void emit(Gen* g, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    g->written += n;
+}
+
+static const char binops[] = "+-*<";
+
+static void emit_number(Gen* g) {
+    if (rand_below(g, 2)) {
+        emit(g, "%u", rand_below(g, 1000));
+    } else {
+        emit(g, "%u.%u", rand_below(g, 100000), rand_below(g, 10000));
+    }
+}
+
+// Call a random earlier `defs` function of arity 3 with numeric arguments.
+static void emit_call(Gen* g) {
+    if (g->defs == 0) {
+        emit_number(g);
+        return;
+    }
+    emit(g, "f%u(", rand_below(g, g->defs));
+    for (int i = 0; i < 3; i++) {
+        if (i) {
+            emit(g, ", ");
+        }
+        emit_number(g);
+    }
+    emit(g, ")");
+}
+
+// Many small definitions with an occasional top-level call.
+static void shape_defs(Gen* g) {
+    emit(g, "def f%u(a b c) a*b+c-", g->defs++);
+    emit_number(g);
+    emit(g, "*a\n");
+    if (rand_below(g, 16) == 0) {
+        emit_call(g);
+        emit(g, ";\n");
+    }
+}
+
+// Long flat binop chains.
+static void shape_binops(Gen* g) {
+    emit_number(g);
+    for (int i = 0; i < 1000; i++) {
+        emit(g, " %c ", binops[rand_below(g, 4)]);
+        emit_number(g);
+    }
+    emit(g, ";\n");
+}
+
+// Deeply nested parentheses inside a definition.
+static void shape_nesting(Gen* g) {
+    const int depth = 200;
+    emit(g, "def f%u(a b c) ", g->defs++);
+    for (int i = 0; i < depth; i++) {
+        emit(g, "(");
+    }
+    emit(g, "a");
+    for (int i = 0; i < depth; i++) {
+        emit(g, " %c %c)", binops[rand_below(g, 3)], "abc"[rand_below(g, 3)]);
+    }
+    emit(g, "\n");
+    emit_call(g);
+    emit(g, ";\n");
+}
+
+// Wide argument lists.
+static void shape_callargs(Gen* g) {
+    const int width = 64;
+    if (g->defs == 0) {
+        emit(g, "def w(");
+        for (int i = 0; i < width; i++) {
+            emit(g, i ? " a%d" : "a%d", i);
+        }
+        emit(g, ") a0 + a%d\n", width - 1);
+        emit(g, "def f0(a b c) a+b+c\n");
+        g->defs = 1;
+    }
+    emit(g, "w(");
+    for (int i = 0; i < width; i++) {
+        if (i) {
+            emit(g, ", ");
+        }
+        if (rand_below(g, 4) == 0) {
+            emit_call(g);
+        } else {
+            emit_number(g);
+        }
+    }
+    emit(g, ");\n");
+}
+
+// Number-heavy expressions.
+static void shape_numbers(Gen* g) {
+    for (int i = 0; i < 32; i++) {
+        if (i) {
+            emit(g, " %c ", binops[rand_below(g, 3)]);
+        }
+        emit(g, "%u.%u", rand_below(g, 1000000000), rand_below(g, 1000000000));
+    }
+    emit(g, ";\n");
+}
+
+// Mostly comments with the occasional definition.
+static void shape_comments(Gen* g) {
+    unsigned lines = 1 + rand_below(g, 8);
+    for (unsigned i = 0; i < lines; i++) {
+        emit(g, "# %016llx comment text that the lexer has to skip over %u\n",
+            (unsigned long long)next_rand(g), i);
+    }
+    shape_defs(g);
+}
+
+static const struct {
+    const char* name;
+    void (*fn)(Gen*);
+} shapes[] = {
+    { "defs", shape_defs },
+    { "binops", shape_binops },
+    { "nesting", shape_nesting },
+    { "callargs", shape_callargs },
+    { "numbers", shape_numbers },
+    { "comments", shape_comments },
+};
+
+static uint64_t parse_size(const char* str) {
+    char* end;
+    uint64_t size = strtoull(str, &end, 10);
+    switch (*end) {
+    case 'G':
+        size *= 1024;
+        // fallthrough
+    case 'M':
+        size *= 1024;
+        // fallthrough
+    case 'K':
+        size *= 1024;
+        break;
+    }
+    return size;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: gen <shape> <size> [seed]\nshapes:");
+        for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+            fprintf(stderr, " %s", shapes[i].name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    uint64_t size = parse_size(argv[2]);
+    Gen g = { argc > 3 ? strtoull(argv[3], NULL, 10) : 0x6b616c65, 0, 0 };
+    if (g.state == 0) {
+        g.state = 1;
+    }
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        if (strcmp(shapes[i].name, argv[1]) == 0) {
+            static char buf[1 << 20];
+            setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+            while (g.written < size) {
+                shapes[i].fn(&g);
+            }
+            return 0;
+        }
+    }
+    fprintf(stderr, "unknown shape: %s\n", argv[1]);
+    return 1;
+}
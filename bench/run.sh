@@ -0,0 +1,112 @@
+#!/bin/sh
+# Benchmark one frontend over the synthetic corpus.
+#
+#   run.sh <name> <kaleidoscopec> [driver flags...]
+#
+# Each (shape, size) corpus is generated once into bench/corpus/ by gen.c
+# and run RUNS times through the driver with --stats. The per-phase
+# throughput (MB/s of source) is summarised as median, min and coefficient
+# of variation, written to bench/results/<name>.tsv and compared against
+# bench/baselines/<name>.tsv when it exists.
+#
+# Environment:
+#   SHAPES  corpus shapes (default: all)
+#   SIZES   corpus sizes, e.g. "1K 1M 1G" (default: 1K 64K 1M 16M)
+#   RUNS    samples per corpus (default: 5)
+#   SAVE=1  store this run as the new baseline
+set -eu
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <name> <kaleidoscopec> [driver flags...]" >&2
+    exit 1
+fi
+name=$1
+driver=$2
+shift 2
+
+benchdir=$(cd "$(dirname "$0")" && pwd)
+SHAPES=${SHAPES:-"defs binops nesting callargs numbers comments"}
+SIZES=${SIZES:-"1K 64K 1M 16M"}
+RUNS=${RUNS:-5}
+
+mkdir -p "$benchdir/build" "$benchdir/corpus" "$benchdir/results" "$benchdir/baselines"
+gen=$benchdir/build/gen
+if [ ! -x "$gen" ] || [ "$benchdir/gen.c" -nt "$gen" ]; then
+    ${GEN_CC:-cc} -O2 -o "$gen" "$benchdir/gen.c"
+fi
+
+results=$benchdir/results/$name.tsv
+baseline=$benchdir/baselines/$name.tsv
+printf 'shape\tsize\tphase\tmedian_mb_s\tmin_mb_s\tcv_pct\n' > "$results"
+
+for shape in $SHAPES; do
+    for size in $SIZES; do
+        corpus=$benchdir/corpus/$shape-$size.txt
+        [ -f "$corpus" ] || "$gen" "$shape" "$size" > "$corpus"
+        samples=$(mktemp)
+        i=0
+        while [ "$i" -lt "$RUNS" ]; do
+            "$driver" --stats "$@" "$corpus" 2>&1 >/dev/null \
+                | grep '"bytes"\|"phases_ns"' | tr -d '\n' >> "$samples"
+            echo >> "$samples"
+            i=$((i + 1))
+        done
+        # One line per sample: bytes followed by "phase": ns pairs.
+        awk -v shape="$shape" -v size="$size" '
+            {
+                match($0, /"bytes": [0-9]+/)
+                bytes = substr($0, RSTART + 9, RLENGTH - 9)
+                rest = substr($0, index($0, "phases_ns"))
+                while (match(rest, /"[a-z]+": [0-9]+/)) {
+                    pair = substr(rest, RSTART, RLENGTH)
+                    rest = substr(rest, RSTART + RLENGTH)
+                    split(pair, kv, "\": ")
+                    phase = substr(kv[1], 2)
+                    if (!(phase in n)) order[++phases] = phase
+                    v[phase, ++n[phase]] = kv[2] > 0 ? bytes / kv[2] * 1000 : 0
+                }
+            }
+            END {
+                for (p = 1; p <= phases; p++) {
+                    phase = order[p]
+                    k = n[phase]
+                    # insertion sort, k is small
+                    for (i = 2; i <= k; i++)
+                        for (j = i; j > 1 && v[phase, j - 1] > v[phase, j]; j--) {
+                            t = v[phase, j]; v[phase, j] = v[phase, j - 1]; v[phase, j - 1] = t
+                        }
+                    median = k % 2 ? v[phase, (k + 1) / 2] : (v[phase, k / 2] + v[phase, k / 2 + 1]) / 2
+                    sum = 0; sq = 0
+                    for (i = 1; i <= k; i++) { sum += v[phase, i]; sq += v[phase, i] ^ 2 }
+                    mean = sum / k
+                    var = sq / k - mean ^ 2
+                    cv = mean > 0 && var > 0 ? sqrt(var) / mean * 100 : 0
+                    printf "%s\t%s\t%s\t%.3f\t%.3f\t%.1f\n", shape, size, phase, median, v[phase, 1], cv
+                }
+            }' "$samples" >> "$results"
+        rm -f "$samples"
+    done
+done
+
+# Join against the baseline on (shape, size, phase) and print the table.
+awk -F '\t' -v base="$baseline" '
+    BEGIN {
+        while ((getline line < base) > 0) {
+            split(line, f, "\t")
+            old[f[1] FS f[2] FS f[3]] = f[4]
+        }
+    }
+    NR == 1 {
+        printf "%-9s %5s %-6s %12s %12s %7s %9s\n", "shape", "size", "phase", "median MB/s", "min MB/s", "cv %", "vs base"
+        next
+    }
+    {
+        key = $1 FS $2 FS $3
+        delta = key in old && old[key] > 0 ? sprintf("%+.1f%%", ($4 / old[key] - 1) * 100) : "-"
+        printf "%-9s %5s %-6s %12.2f %12.2f %7.1f %9s\n", $1, $2, $3, $4, $5, $6, delta
+    }' "$results"
+
+if [ "${SAVE:-0}" = 1 ]; then
+    cp "$results" "$baseline"
+    echo "saved baseline $baseline"
+fi
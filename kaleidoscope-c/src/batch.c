@@ -0,0 +1,384 @@
+#include "arena.h"
+#include "carena.h"
+#include "lexer.h"
+#include "lines.h"
+#include "loader.h"
+#include "parser.h"
+#include "stats.h"
+#include "types.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    const char* path;
+    usize size;
+    // Filled in by the worker that compiles it.
+    int error; // errno if the file could not be read
+    Diagnostic* diagnostics; // malloc'd; outlives the worker's arena
+    usize diagnosticsCount;
+    u64 tokens;
+    u64 items;
+} Job;
+
+// ---- Work-stealing deque ----
+
+// Chase-Lev deque over a fixed job list: the owner pops from the bottom,
+// thieves take from the top. Jobs are never pushed after the workers start,
+// so only the pop/steal halves of the algorithm are needed.
+typedef struct {
+    _Atomic(ptrdiff_t) top;
+    _Atomic(ptrdiff_t) bottom;
+    usize* jobs;
+} JobDeque;
+
+static bool deque_pop(JobDeque* d, usize* job) {
+    ptrdiff_t b = atomic_load(&d->bottom) - 1;
+    atomic_store(&d->bottom, b);
+    atomic_thread_fence(memory_order_seq_cst);
+    ptrdiff_t t = atomic_load(&d->top);
+    if (t > b) {
+        atomic_store(&d->bottom, b + 1);
+        return false;
+    }
+    *job = d->jobs[b];
+    if (t == b) {
+        // Last job: race the thieves for it.
+        bool won = atomic_compare_exchange_strong(&d->top, &t, t + 1);
+        atomic_store(&d->bottom, b + 1);
+        return won;
+    }
+    return true;
+}
+
+typedef enum {
+    StealEmpty,
+    StealLost,
+    StealWon
+} StealResult;
+
+static StealResult deque_steal(JobDeque* d, usize* job) {
+    ptrdiff_t t = atomic_load(&d->top);
+    atomic_thread_fence(memory_order_seq_cst);
+    ptrdiff_t b = atomic_load(&d->bottom);
+    if (t >= b) {
+        return StealEmpty;
+    }
+    *job = d->jobs[t];
+    return atomic_compare_exchange_strong(&d->top, &t, t + 1) ? StealWon : StealLost;
+}
+
+// ---- Workers ----
+
+typedef struct Batch Batch;
+
+typedef struct {
+    Batch* batch;
+    usize index;
+    pthread_t thread;
+    JobDeque deque;
+    u64 busyNs;
+    u64 files;
+} Worker;
+
+struct Batch {
+    Job* jobs;
+    usize jobsCount;
+    Worker* workers;
+    usize workersCount;
+    ConcurrentArena arena; // every worker's allocations, freed together
+    Loader* loader; // reads the files ahead; NULL if workers read their own
+};
+
+// NULL, with errno set, if the file cannot be opened or read.
+static char* load_file(Arena* arena, const char* path, usize* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+    char* code = arena_alloc(arena, st.st_size + 1);
+    usize length = 0;
+    while (length < (usize)st.st_size) {
+        ssize_t n = read(fd, code + length, st.st_size - length);
+        if (n < 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        length += n;
+    }
+    close(fd);
+    code[length] = '\0';
+    *size = length;
+    return code;
+}
+
+// Lex and parse one file's contents in the worker's arena, recording the
+// outcome in the job rather than aborting the batch.
+static void compile_code(ArenaThread* t, Job* job, const char* code) {
+    Arena* arena = &t->arena;
+    // lex() takes a token per byte up front; the tree takes less again.
+    carena_reserve(t, sizeof(Token) * (job->size + 1) * 2);
+    Token* tokens = lex(arena, code);
+    for (Token* t = tokens; t->kind != TokEof; t++) {
+        job->tokens++;
+    }
+    usize itemsCount;
+    Diagnostics diags = { .recover = true };
+    parse_program(arena, tokens, &itemsCount, &diags);
+    job->items = itemsCount;
+    if (diags.count > 0) {
+        LineIndex lines;
+        line_index_build(&lines, arena, code, job->size);
+        diagnostics_locate(&diags, &lines);
+        job->diagnostics = malloc(sizeof(Diagnostic) * diags.count);
+        memcpy(job->diagnostics, diags.items, sizeof(Diagnostic) * diags.count);
+        job->diagnosticsCount = diags.count;
+    }
+}
+
+static void compile_job(ArenaThread* t, Job* job) {
+    carena_rewind(t, (ArenaSnapshot) { 0 });
+    char* code = load_file(&t->arena, job->path, &job->size);
+    if (!code) {
+        job->error = errno;
+        job->size = 0;
+        return;
+    }
+    compile_code(t, job, code);
+}
+
+// Compile files in the order the loader finishes reading them.
+static void compile_loaded(Worker* w, ArenaThread* arena) {
+    Batch* batch = w->batch;
+    LoadedFile file;
+    while (loader_next(batch->loader, &file)) {
+        u64 start = now_ns();
+        Job* job = &batch->jobs[file.index];
+        job->size = file.size;
+        if (file.code) {
+            carena_rewind(arena, (ArenaSnapshot) { 0 });
+            compile_code(arena, job, file.code);
+        } else {
+            job->error = file.error;
+        }
+        loader_release(batch->loader, &file);
+        w->busyNs += now_ns() - start;
+        w->files++;
+    }
+}
+
+static bool next_job(Worker* w, usize* job) {
+    if (deque_pop(&w->deque, job)) {
+        return true;
+    }
+    Batch* batch = w->batch;
+    while (true) {
+        bool lost = false;
+        for (usize i = 1; i < batch->workersCount; i++) {
+            Worker* victim = &batch->workers[(w->index + i) % batch->workersCount];
+            switch (deque_steal(&victim->deque, job)) {
+            case StealWon:
+                return true;
+            case StealLost:
+                lost = true;
+                break;
+            case StealEmpty:
+                break;
+            }
+        }
+        // Nothing is ever pushed, so a sweep that found every deque empty
+        // means the batch is done.
+        if (!lost) {
+            return false;
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    Worker* w = arg;
+    ArenaThread* arena = carena_thread(&w->batch->arena);
+    if (w->batch->loader) {
+        compile_loaded(w, arena);
+        return NULL;
+    }
+    usize job;
+    while (next_job(w, &job)) {
+        u64 start = now_ns();
+        compile_job(arena, &w->batch->jobs[job]);
+        w->busyNs += now_ns() - start;
+        w->files++;
+    }
+    return NULL;
+}
+
+// ---- Driver ----
+
+static int compare_jobs_by_size(const void* lhs, const void* rhs) {
+    const Job* a = lhs;
+    const Job* b = rhs;
+    return (a->size < b->size) - (a->size > b->size);
+}
+
+static void add_job(Arena* arena, Job** jobs, usize* count, usize* capacity, const char* path) {
+    if (*count == *capacity) {
+        *jobs = arena_realloc(arena, *jobs, sizeof(Job) * *capacity, sizeof(Job) * *capacity * 2);
+        *capacity *= 2;
+    }
+    (*jobs)[(*count)++] = (Job) { .path = path };
+}
+
+// Paths listed one per line in a manifest file.
+static bool add_manifest(Arena* arena, Job** jobs, usize* count, usize* capacity, const char* manifest) {
+    usize size;
+    char* text = load_file(arena, manifest, &size);
+    if (!text) {
+        return false;
+    }
+    for (char* line = strtok(text, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        if (*line) {
+            add_job(arena, jobs, count, capacity, line);
+        }
+    }
+    return true;
+}
+
+// Start reading the jobs' files through io_uring, with a read-ahead window
+// that keeps every worker busy. False where io_uring is unavailable.
+static bool start_loader(Arena* arena, Batch* batch, Loader* loader) {
+    const char** paths = arena_alloc(arena, sizeof(char*) * (batch->jobsCount + 1));
+    for (usize i = 0; i < batch->jobsCount; i++) {
+        paths[i] = batch->jobs[i].path;
+    }
+    u32 window = batch->workersCount * 4 < 16 ? 16 : batch->workersCount * 4;
+    if (!loader_start(loader, paths, batch->jobsCount, window)) {
+        return false;
+    }
+    batch->loader = loader;
+    return true;
+}
+
+// `--batch [-j N] [--no-io-uring] <file | @manifest>...`: compile many files
+// across a pool of workers and report aggregate throughput and per-file
+// failures. Files are read ahead through io_uring and compiled as they
+// arrive; without it, each worker reads its own files, largest first, and
+// idle workers steal from the others.
+int run_batch(int argc, char** argv) {
+    Arena arena = { 0 };
+    usize capacity = 64;
+    usize jobsCount = 0;
+    Job* jobs = arena_alloc(&arena, sizeof(Job) * capacity);
+    long workersCount = sysconf(_SC_NPROCESSORS_ONLN);
+    bool ioUring = true;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workersCount = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+            ioUring = false;
+        } else if (argv[i][0] == '@') {
+            if (!add_manifest(&arena, &jobs, &jobsCount, &capacity, argv[i] + 1)) {
+                fprintf(stderr, "Error opening manifest %s: %s\n", argv[i] + 1, strerror(errno));
+                arena_free(&arena);
+                return 1;
+            }
+        } else {
+            add_job(&arena, &jobs, &jobsCount, &capacity, argv[i]);
+        }
+    }
+    if (workersCount < 1) {
+        workersCount = 1;
+    }
+
+    u64 start = now_ns();
+    Batch batch = { .jobs = jobs, .jobsCount = jobsCount, .workersCount = workersCount };
+    carena_init(&batch.arena);
+    Loader loader;
+    if (!ioUring || !start_loader(&arena, &batch, &loader)) {
+        // Largest first, dealt round-robin so every worker starts with a
+        // similar share; stealing evens out the rest.
+        for (usize i = 0; i < jobsCount; i++) {
+            struct stat st;
+            if (stat(jobs[i].path, &st) == 0) {
+                jobs[i].size = st.st_size;
+            }
+        }
+        qsort(jobs, jobsCount, sizeof(Job), compare_jobs_by_size);
+    }
+    batch.workers = arena_alloc(&arena, sizeof(Worker) * workersCount);
+    for (long w = 0; w < workersCount; w++) {
+        Worker* worker = &batch.workers[w];
+        *worker = (Worker) { .batch = &batch, .index = w };
+        if (batch.loader) {
+            continue;
+        }
+        usize share = (jobsCount + workersCount - 1 - w) / workersCount;
+        worker->deque.jobs = arena_alloc(&arena, sizeof(usize) * (share + 1));
+        // The owner pops from the bottom, so put its largest job there.
+        for (usize j = 0; j < share; j++) {
+            worker->deque.jobs[share - 1 - j] = w + j * workersCount;
+        }
+        atomic_init(&worker->deque.top, 0);
+        atomic_init(&worker->deque.bottom, share);
+    }
+
+    for (long w = 1; w < workersCount; w++) {
+        pthread_create(&batch.workers[w].thread, NULL, worker_main, &batch.workers[w]);
+    }
+    worker_main(&batch.workers[0]);
+    for (long w = 1; w < workersCount; w++) {
+        pthread_join(batch.workers[w].thread, NULL);
+    }
+    if (batch.loader) {
+        loader_stop(batch.loader);
+    }
+    u64 wallNs = now_ns() - start;
+
+    u64 bytes = 0;
+    u64 tokens = 0;
+    usize failed = 0;
+    for (usize i = 0; i < jobsCount; i++) {
+        bytes += jobs[i].size;
+        tokens += jobs[i].tokens;
+        if (jobs[i].error) {
+            failed++;
+            fprintf(stderr, "%s: error: %s\n", jobs[i].path, strerror(jobs[i].error));
+        } else if (jobs[i].diagnosticsCount > 0) {
+            failed++;
+            Diagnostics diags = { .items = jobs[i].diagnostics, .count = jobs[i].diagnosticsCount };
+            diagnostics_print(stderr, jobs[i].path, &diags);
+            free(jobs[i].diagnostics);
+        }
+    }
+    u64 busyNs = 0;
+    for (long w = 0; w < workersCount; w++) {
+        busyNs += batch.workers[w].busyNs;
+    }
+    carena_free(&batch.arena);
+    double seconds = wallNs / 1e9;
+    printf("batch: %zu files, %zu failed, %llu bytes, %llu tokens in %.3f s"
+           " (%.2f MB/s, %.0f files/s), %ld workers, %.1f%% utilization\n",
+        jobsCount, failed, (unsigned long long)bytes, (unsigned long long)tokens, seconds,
+        bytes / 1e6 / seconds, jobsCount / seconds, workersCount,
+        wallNs ? 100.0 * busyNs / ((double)wallNs * workersCount) : 0.0);
+
+    arena_free(&arena);
+    return failed ? 1 : 0;
+}
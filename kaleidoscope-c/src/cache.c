@@ -0,0 +1,250 @@
+#include "cache.h"
+#include "cgen.h"
+#include "eval.h"
+#include "ir.h"
+#include "writer.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+// ---- Key ----
+
+static u64 hash_bytes(u64 hash, const void* data, usize size) {
+    const u8* bytes = data;
+    for (usize i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static u64 hash_u32(u64 hash, u32 value) {
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
+static u64 hash_str(u64 hash, const char* str) {
+    return hash_bytes(hash, str, strlen(str) + 1);
+}
+
+// The CPU -march=native resolves to, from its signature and every word of
+// CPUID that lists extensions the host compiler may enable, so an object is
+// never loaded on a CPU that lacks one it was built with. What identifies
+// the core it happens to run on is left out.
+static u64 hash_cpu(u64 hash) {
+#if defined(__x86_64__) || defined(__i386__)
+    static const u32 leaves[][2] = {
+        { 0, 0 }, { 1, 0 }, { 7, 0 }, { 7, 1 }, { 0xd, 1 }, { 0x19, 0 }, { 0x24, 0 }, { 0x80000001, 0 }, { 0x80000008, 0 },
+    };
+    u32 features = 0;
+    for (usize i = 0; i < sizeof(leaves) / sizeof(leaves[0]); i++) {
+        u32 r[4] = { 0 };
+        __get_cpuid_count(leaves[i][0], leaves[i][1], &r[0], &r[1], &r[2], &r[3]);
+        if (leaves[i][0] == 1) {
+            features = r[2];
+            r[1] = 0; // APIC ID and logical processor count
+        }
+        hash = hash_bytes(hash, r, sizeof(r));
+    }
+    // The state the OS saves, without which the AVX extensions are off.
+    if (features & bit_OSXSAVE) {
+        u32 low, high;
+        __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+        hash = hash_u32(hash_u32(hash, low), high);
+    }
+#elif defined(__linux__)
+    unsigned long hwcaps[] = { getauxval(AT_HWCAP), getauxval(AT_HWCAP2) };
+    hash = hash_bytes(hash, hwcaps, sizeof(hwcaps));
+#endif
+    return hash;
+}
+
+// Everything a cached object depends on but the function itself.
+static u64 cache_salt(const char* cc) {
+    static const char* const flags[] = { CGEN_SHARED_FLAGS };
+    u64 hash = hash_str(14695981039346656037ull, NATIVE_CACHE_VERSION);
+    hash = hash_str(hash, cc);
+    for (usize i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        hash = hash_str(hash, flags[i]);
+    }
+    return hash_cpu(hash);
+}
+
+// Hash the optimized IR of function `index`, the normal form of its
+// definition: names of parameters and of the function itself are gone, and
+// the bodies it inlined are part of it. Callees are hashed by name, as
+// that is what they are linked by.
+static u64 function_key(const NativeCache* c, const IrModule* m, u32 index) {
+    const IrFunction* fn = m->functions[index];
+    u64 hash = hash_u32(c->salt, fn->paramsCount);
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        hash = hash_u32(hash, block->dead ? IR_NONE : bi);
+        if (block->dead) {
+            continue;
+        }
+        hash = hash_bytes(hash, block->preds, sizeof(u32) * block->predsCount);
+        for (u32 i = 0; i < block->instsCount; i++) {
+            IrValue v = block->insts[i];
+            const IrInst* inst = &fn->insts[v];
+            hash = hash_u32(hash_u32(hash, v), inst->op);
+            switch (inst->op) {
+            case IrConst:
+                hash = hash_bytes(hash, &inst->value.number, sizeof(double));
+                break;
+            case IrParam:
+                hash = hash_u32(hash, inst->value.param);
+                break;
+            case IrAdd:
+            case IrSub:
+            case IrMul:
+            case IrLess:
+                hash = hash_bytes(hash, inst->value.operands, sizeof(inst->value.operands));
+                break;
+            case IrCall: {
+                u32 callee = inst->value.call.callee;
+                hash = callee == index ? hash_u32(hash, IR_NONE) : hash_str(hash, m->functions[callee]->name);
+                hash = hash_bytes(hash, fn->operands + inst->value.call.first, sizeof(IrValue) * inst->value.call.count);
+                hash = hash_u32(hash, inst->value.call.count);
+                break;
+            }
+            case IrPhi:
+                hash = hash_bytes(hash, fn->operands + inst->value.phi, sizeof(IrValue) * ir_operand_count(fn, inst, bi));
+                break;
+            }
+        }
+        hash = hash_bytes(hash, &block->term, sizeof(block->term));
+    }
+    return hash;
+}
+
+// ---- Objects ----
+
+bool native_cache_init(NativeCache* c, const char* dir) {
+    *c = (NativeCache) { .dir = dir, .cc = getenv("CC") };
+    if (!c->cc || !*c->cc) {
+        c->cc = "cc";
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return false;
+    }
+    c->salt = cache_salt(c->cc);
+    return true;
+}
+
+void native_cache_free(NativeCache* c) {
+    for (u32 i = 0; i < c->handlesCount; i++) {
+        dlclose(c->handles[i]);
+    }
+    free(c->handles);
+    c->handles = NULL;
+    c->handlesCount = 0;
+}
+
+// Generate and build function `index` into `path`. The object is built
+// under a name of its own and renamed into place, so concurrent runs
+// never load a partial one.
+static bool build_object(NativeCache* c, const IrModule* m, u32 index, u64 key, const char* path) {
+    char cPath[PATH_MAX], soPath[PATH_MAX];
+    snprintf(cPath, sizeof(cPath), "%s/%016llx.%d.c", c->dir, (unsigned long long)key, (int)getpid());
+    snprintf(soPath, sizeof(soPath), "%s/%016llx.%d.so", c->dir, (unsigned long long)key, (int)getpid());
+    int fd = open(cPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(cPath);
+        return false;
+    }
+    Writer out;
+    writer_init(&out, fd);
+    cgen_unit(&out, m, index, key);
+    writer_free(&out);
+    close(fd);
+
+    int status = cgen_build_shared(cPath, soPath);
+    unlink(cPath);
+    if (status == 127) {
+        fprintf(stderr, "native cache: cannot run %s; definitions stay in the interpreter\n", c->cc);
+        c->broken = true;
+    }
+    if (status != 0 || rename(soPath, path) < 0) {
+        unlink(soPath);
+        return false;
+    }
+    return true;
+}
+
+// Point the relocations of a loaded object at the evaluator. NULL if the
+// object is not the one `key` names, as after a hash collision or when
+// it was written by another version.
+static NativeFn link_object(void* handle, Evaluator* ev, u64 key) {
+    const unsigned long long* objectKey = dlsym(handle, "ks_key");
+    const char* const* symbols = dlsym(handle, "ks_symbols");
+    u32* callees = dlsym(handle, "ks_callees");
+    NativeFn entry = (NativeFn)dlsym(handle, "ks_entry");
+    EvalNativeCall* call = dlsym(handle, "ks_call");
+    EvalNativeCall* tail = dlsym(handle, "ks_tail");
+    EvalNativeDrain* drain = dlsym(handle, "ks_drain");
+    EvalNativeOverflow* overflow = dlsym(handle, "ks_overflow");
+    void** ctx = dlsym(handle, "ks_ctx");
+    const u32** pending = dlsym(handle, "ks_pending");
+    const char* const** error = dlsym(handle, "ks_error");
+    const char* const** stackLimit = dlsym(handle, "ks_stack_limit");
+    if (!objectKey || *objectKey != key || !symbols || !callees || !entry || !call || !tail || !drain || !overflow || !ctx || !pending || !error
+        || !stackLimit) {
+        return NULL;
+    }
+    for (u32 i = 0; symbols[i]; i++) {
+        callees[i] = ir_function(&ev->module, symbols[i]);
+    }
+    *call = eval_native_call;
+    *tail = eval_native_tail;
+    *drain = eval_native_drain;
+    *overflow = eval_native_overflow;
+    *ctx = ev;
+    *pending = &ev->tailCallee;
+    *error = &ev->error;
+    *stackLimit = &ev->stackLimit;
+    return entry;
+}
+
+// Machine code for definition `index`, which has been materialized, from
+// the cache or built into it. NULL to leave it to the interpreter.
+NativeFn native_cache_load(NativeCache* c, Evaluator* ev, u32 index) {
+    u64 key = function_key(c, &ev->module, index);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%016llx.so", c->dir, (unsigned long long)key);
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    NativeFn entry = handle ? link_object(handle, ev, key) : NULL;
+    if (entry) {
+        c->hits++;
+    } else {
+        if (handle) {
+            dlclose(handle);
+        }
+        c->misses++;
+        handle = !c->broken && build_object(c, &ev->module, index, key, path) ? dlopen(path, RTLD_NOW | RTLD_LOCAL) : NULL;
+        entry = handle ? link_object(handle, ev, key) : NULL;
+        if (!entry) {
+            if (handle) {
+                dlclose(handle);
+            }
+            c->failed++;
+            return NULL;
+        }
+    }
+    if (c->handlesCount == c->handlesCapacity) {
+        c->handlesCapacity = c->handlesCapacity ? c->handlesCapacity * 2 : 64;
+        c->handles = realloc(c->handles, sizeof(void*) * c->handlesCapacity);
+    }
+    c->handles[c->handlesCount++] = handle;
+    return entry;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "eval.h"
+#include "types.h"
+#include <stdbool.h>
+
+#define NATIVE_CACHE_VERSION "kaleidoscope-native-3"
+
+// Persistent cache of machine code for definitions, shared across runs
+// through a directory. When the evaluator first calls a definition, the
+// optimized IR it lowered the definition to is hashed, together with the
+// backend version, host compiler, flags and the CPU -march=native resolves
+// to. The object file under that key is loaded if it exists; otherwise the
+// definition is generated as C, built into a shared object with the host
+// compiler and stored there for the next run. Either way, its calls are
+// linked to the evaluator by name, and the definition then runs as machine
+// code.
+struct NativeCache {
+    const char* dir;
+    const char* cc;
+    u64 salt; // the key of everything but the function
+    void** handles; // dlopen()ed objects, closed together
+    u32 handlesCount;
+    u32 handlesCapacity;
+    u64 hits;
+    u64 misses;
+    u64 failed; // misses that could not be built, left to the interpreter
+    bool broken; // the host compiler could not be run: stop trying
+};
+
+bool native_cache_init(NativeCache* c, const char* dir);
+void native_cache_free(NativeCache* c);
+NativeFn native_cache_load(NativeCache* c, Evaluator* ev, u32 index);
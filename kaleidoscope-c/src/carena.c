@@ -0,0 +1,235 @@
+#include "carena.h"
+#include "arena.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+void carena_init(ConcurrentArena* ca) {
+    // Every slot starts out free, each linked to the next.
+    ca->slots = malloc(sizeof(PoolSlot) * CARENA_POOL_SLOTS);
+    for (u32 i = 0; i < CARENA_POOL_SLOTS; i++) {
+        ca->slots[i].region = NULL;
+        atomic_init(&ca->slots[i].next, i + 1 < CARENA_POOL_SLOTS ? i + 2 : 0);
+    }
+    atomic_init(&ca->pool.head, 0);
+    atomic_init(&ca->freeSlots.head, 1);
+    atomic_init(&ca->poolCount, 0);
+    atomic_init(&ca->threadsCount, 0);
+    atomic_init(&ca->threads, NULL);
+}
+
+// Join the family. The returned arena belongs to the calling thread until
+// the family is freed, and stays valid across carena_reset().
+ArenaThread* carena_thread(ConcurrentArena* ca) {
+    ArenaThread* t = malloc(sizeof(ArenaThread));
+    t->arena = (Arena) { 0 };
+    t->family = ca;
+    atomic_fetch_add_explicit(&ca->threadsCount, 1, memory_order_relaxed);
+    t->next = atomic_load_explicit(&ca->threads, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&ca->threads, &t->next, t, memory_order_release, memory_order_relaxed)) { }
+    return t;
+}
+
+#define POOL_GENERATION (1ull << 32)
+
+static void stack_push(ConcurrentArena* ca, PoolStack* s, u32 slot) {
+    u64 head = atomic_load_explicit(&s->head, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&ca->slots[slot].next, (u32)head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&s->head, &head, ((head & ~0xffffffffull) + POOL_GENERATION) | (slot + 1), memory_order_release, memory_order_relaxed));
+}
+
+// The slot popped, or CARENA_POOL_SLOTS if the stack is empty.
+static u32 stack_pop(ConcurrentArena* ca, PoolStack* s) {
+    u64 head = atomic_load_explicit(&s->head, memory_order_acquire);
+    while ((u32)head) {
+        u32 next = atomic_load_explicit(&ca->slots[(u32)head - 1].next, memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&s->head, &head, ((head & ~0xffffffffull) + POOL_GENERATION) | next, memory_order_acquire, memory_order_acquire)) {
+            return (u32)head - 1;
+        }
+    }
+    return CARENA_POOL_SLOTS;
+}
+
+// An empty region from the pool, or NULL if it is empty.
+static Region* pool_pop(ConcurrentArena* ca) {
+    u32 slot = stack_pop(ca, &ca->pool);
+    if (slot == CARENA_POOL_SLOTS) {
+        return NULL;
+    }
+    Region* r = ca->slots[slot].region;
+    atomic_fetch_sub_explicit(&ca->poolCount, 1, memory_order_relaxed);
+    stack_push(ca, &ca->freeSlots, slot);
+    return r;
+}
+
+// Give back an empty region that no thread holds: default-sized ones to
+// the pool, where any thread can pick them up again, unless it is full;
+// oversized ones to malloc. The count is checked before the region goes
+// in, so racing threads may overshoot the limit by one region each.
+static void release_region(ConcurrentArena* ca, Region* r) {
+    usize limit = atomic_load_explicit(&ca->threadsCount, memory_order_relaxed) * CARENA_POOL_PER_THREAD;
+    if (r->capacity <= REGION_DEFAULT_CAPACITY && atomic_load_explicit(&ca->poolCount, memory_order_relaxed) < limit) {
+        u32 slot = stack_pop(ca, &ca->freeSlots);
+        if (slot != CARENA_POOL_SLOTS) {
+            r->count = 0;
+            ca->slots[slot].region = r;
+            atomic_fetch_add_explicit(&ca->poolCount, 1, memory_order_relaxed);
+            stack_push(ca, &ca->pool, slot);
+            return;
+        }
+    }
+    free_region(r);
+}
+
+// Slow path of carena_alloc(): `size` words do not fit the current region.
+// Regions this thread holds past it are empty, as after a rewind; the
+// first that fits is used, and the ones before it, too small, are given
+// back. Then come the pool and malloc.
+void* carena_refill(ArenaThread* t, usize size) {
+    Arena* a = &t->arena;
+    Region* tail = a->end;
+    while (tail && tail->next) {
+        Region* r = tail->next;
+        if (size <= r->capacity) {
+            a->end = r;
+            r->count = size;
+            return r->data;
+        }
+        tail->next = r->next;
+        release_region(t->family, r);
+    }
+    // Pooled regions have the default capacity; larger allocations get a
+    // region of their own.
+    Region* r = size <= REGION_DEFAULT_CAPACITY ? pool_pop(t->family) : NULL;
+    if (r) {
+        r->next = NULL;
+    } else {
+        r = new_region(size > REGION_DEFAULT_CAPACITY ? size : REGION_DEFAULT_CAPACITY);
+    }
+    if (tail) {
+        tail->next = r;
+    } else {
+        a->begin = r;
+    }
+    a->end = r;
+    r->count = size;
+    return r->data;
+}
+
+ArenaSnapshot carena_snapshot(const ArenaThread* t) {
+    Region* r = t->arena.end;
+    return (ArenaSnapshot) { r, r ? r->count : 0 };
+}
+
+// Drop everything this thread allocated since `snapshot`. The regions that
+// empties stay with the thread for its next allocations, largest first,
+// but only as many as it takes to hold what was dropped: the rest are
+// given back. A thread that rewinds between jobs of different sizes thus
+// keeps about one job's worth of regions, rather than every region that
+// any of its jobs outgrew.
+void carena_rewind(ArenaThread* t, ArenaSnapshot snapshot) {
+    Arena* a = &t->arena;
+    Region* r = snapshot.region ? snapshot.region : a->begin;
+    if (!r) {
+        return;
+    }
+    usize dropped = r->count - snapshot.count;
+    r->count = snapshot.count;
+    a->end = r;
+
+    // Sort the emptied regions by capacity, largest first.
+    Region* emptied = NULL;
+    for (Region* after = r->next; after;) {
+        Region* next = after->next;
+        dropped += after->count;
+        after->count = 0;
+        Region** at = &emptied;
+        while (*at && (*at)->capacity >= after->capacity) {
+            at = &(*at)->next;
+        }
+        after->next = *at;
+        *at = after;
+        after = next;
+    }
+    usize kept = r->capacity - r->count;
+    Region* tail = r;
+    while (emptied) {
+        Region* next = emptied->next;
+        if (kept < dropped) {
+            kept += emptied->capacity;
+            tail->next = emptied;
+            tail = emptied;
+        } else {
+            release_region(t->family, emptied);
+        }
+        emptied = next;
+    }
+    tail->next = NULL;
+}
+
+// Make sure the thread's next allocations, up to `bytes` in all, fit in one
+// region, as before a job whose size is known. The region comes right
+// after the current one, so the allocations move on to it as soon as one
+// does not fit the current one. A new region is at least twice the
+// largest this thread holds, so that jobs which each need a little more
+// than the last, as when they come smallest first, rarely need another.
+void carena_reserve(ArenaThread* t, usize bytes) {
+    usize size = (bytes + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+    Arena* a = &t->arena;
+    Region* end = a->end;
+    if (end && end->count + size <= end->capacity) {
+        return;
+    }
+    // The largest region past the end, which are all empty.
+    Region** largest = NULL;
+    for (Region** at = end ? &end->next : NULL; at && *at; at = &(*at)->next) {
+        if (!largest || (*at)->capacity > (*largest)->capacity) {
+            largest = at;
+        }
+    }
+    Region* r;
+    if (largest && (*largest)->capacity >= size) {
+        r = *largest;
+        *largest = r->next;
+    } else {
+        usize capacity = largest && (*largest)->capacity * 2 > size ? (*largest)->capacity * 2 : size;
+        r = new_region(capacity > REGION_DEFAULT_CAPACITY ? capacity : REGION_DEFAULT_CAPACITY);
+    }
+    if (end) {
+        r->next = end->next;
+        end->next = r;
+    } else {
+        r->next = NULL;
+        a->begin = a->end = r;
+    }
+}
+
+// Release every allocation of every thread at once. Default-sized regions
+// return to the pool as far as it has room; oversized ones are freed, so
+// repeated compilations do not accumulate them.
+void carena_reset(ConcurrentArena* ca) {
+    for (ArenaThread* t = atomic_load(&ca->threads); t; t = t->next) {
+        for (Region* r = t->arena.begin; r;) {
+            Region* next = r->next;
+            release_region(ca, r);
+            r = next;
+        }
+        t->arena = (Arena) { 0 };
+    }
+}
+
+void carena_free(ConcurrentArena* ca) {
+    for (Region* r; (r = pool_pop(ca));) {
+        free_region(r);
+    }
+    free(ca->slots);
+    ArenaThread* t = atomic_load(&ca->threads);
+    while (t) {
+        ArenaThread* next = t->next;
+        arena_free(&t->arena);
+        free(t);
+        t = next;
+    }
+    *ca = (ConcurrentArena) { 0 };
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "arena.h"
+#include "types.h"
+#include <stdatomic.h>
+
+typedef struct ArenaThread ArenaThread;
+
+// Where the pool keeps a region. Slots are never freed while the family
+// lives, so a thread may still read `next` of one another thread has
+// just taken.
+typedef struct {
+    Region* region;
+    _Atomic(u32) next; // index + 1 of the slot below, 0 at the bottom
+} PoolSlot;
+
+// A lock-free stack of slots. The low half of `head` is the index + 1 of
+// the top slot, 0 when empty; the high half is a generation that every
+// push and pop bumps. A pop that read the top and its `next` before other
+// threads popped that slot and pushed it back thus fails its
+// compare-and-swap, instead of installing a stale `next` (ABA).
+typedef struct {
+    _Atomic(u64) head;
+} PoolStack;
+
+// A family of per-thread arenas that share a pool of empty regions and
+// are reset or freed as one unit. Each thread allocates from its own
+// ArenaThread without synchronization; the pool, which a thread touches
+// once per region, and joining the family are lock-free.
+//
+// carena_reset() and carena_free() must not run concurrently with any
+// other use of the family.
+typedef struct {
+    // Empty default-sized regions, in the slots on the `pool` stack; the
+    // other slots are on `freeSlots`. Threads give back the ones a rewind
+    // leaves them without use for, and carena_reset() gives back all of
+    // them. Past CARENA_POOL_PER_THREAD regions per thread, or when no
+    // slot is free, they are freed instead: allocations through arena.h
+    // never take from the pool.
+    PoolSlot* slots;
+    PoolStack pool;
+    PoolStack freeSlots;
+    _Atomic(usize) poolCount;
+    _Atomic(usize) threadsCount;
+    _Atomic(ArenaThread*) threads;
+} ConcurrentArena;
+
+#define CARENA_POOL_PER_THREAD 64
+#define CARENA_POOL_SLOTS 4096
+
+// One thread's share of a ConcurrentArena. `arena` is an ordinary Arena,
+// so code written against arena.h can allocate from it directly; regions
+// it adds itself are adopted by the family all the same.
+struct ArenaThread {
+    Arena arena;
+    ConcurrentArena* family;
+    ArenaThread* next; // in family->threads
+};
+
+// Position in one thread's arena to rewind to.
+typedef struct {
+    Region* region;
+    usize count;
+} ArenaSnapshot;
+
+void carena_init(ConcurrentArena* ca);
+ArenaThread* carena_thread(ConcurrentArena* ca);
+void* carena_refill(ArenaThread* t, usize size);
+ArenaSnapshot carena_snapshot(const ArenaThread* t);
+void carena_rewind(ArenaThread* t, ArenaSnapshot snapshot);
+void carena_reserve(ArenaThread* t, usize bytes);
+void carena_reset(ConcurrentArena* ca);
+void carena_free(ConcurrentArena* ca);
+
+static inline void* carena_alloc(ArenaThread* t, usize bytes) {
+    usize size = (bytes + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+    Region* r = t->arena.end;
+    if (r && r->count + size <= r->capacity) {
+        void* result = &r->data[r->count];
+        r->count += size;
+        return result;
+    }
+    return carena_refill(t, size);
+}
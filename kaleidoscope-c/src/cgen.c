@@ -0,0 +1,533 @@
+#include "cgen.h"
+#include "eval.h"
+#include "parser.h"
+#include "writer.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// ---- Output ----
+
+static void emit_v(Cgen* cg, const char* fmt, va_list args) {
+    char buf[256];
+    va_list retry;
+    va_copy(retry, args);
+    int length = vsnprintf(buf, sizeof(buf), fmt, args);
+    if (length < (int)sizeof(buf)) {
+        writer_str(cg->out, buf);
+    } else {
+        // Long identifiers.
+        char* big = malloc(length + 1);
+        vsnprintf(big, length + 1, fmt, retry);
+        writer_str(cg->out, big);
+        free(big);
+    }
+    va_end(retry);
+}
+
+static void emit(Cgen* cg, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    emit_v(cg, fmt, args);
+    va_end(args);
+}
+
+// ---- Values ----
+
+// How an IR value is spelled in C: a literal, a parameter or a local.
+typedef struct {
+    char text[40];
+} Operand;
+
+static Operand number_operand(double value) {
+    Operand op;
+    if (isnan(value)) {
+        snprintf(op.text, sizeof(op.text), "NAN");
+    } else if (isinf(value)) {
+        snprintf(op.text, sizeof(op.text), value < 0 ? "(-HUGE_VAL)" : "HUGE_VAL");
+    } else {
+        snprintf(op.text, sizeof(op.text), value < 0 ? "(%.17g" : "%.17g", value);
+        if (!strpbrk(op.text, ".e")) {
+            strcat(op.text, ".0");
+        }
+        if (value < 0) {
+            strcat(op.text, ")");
+        }
+    }
+    return op;
+}
+
+static Operand value_operand(const IrFunction* fn, IrValue value) {
+    const IrInst* inst = &fn->insts[value];
+    if (inst->op == IrConst) {
+        return number_operand(inst->value.number);
+    }
+    Operand op;
+    if (inst->op == IrParam) {
+        snprintf(op.text, sizeof(op.text), "a%u", inst->value.param);
+    } else {
+        snprintf(op.text, sizeof(op.text), "v%u", value);
+    }
+    return op;
+}
+
+// ---- Functions ----
+
+// Definitions are `ks_<name>` and top-level expressions `ks__expr<index>`:
+// identifiers are alphanumeric, so no definition takes the latter's name.
+static void emit_function_name(Cgen* cg, u32 index) {
+    const IrFunction* fn = cg->ir->functions[index];
+    if (index == cg->unit) {
+        writer_str(cg->out, "ks_fn");
+    } else if (!fn->name) {
+        emit(cg, "ks__expr%u", index);
+    } else {
+        emit(cg, fn->defined ? "ks_%s" : "%s", fn->name);
+    }
+}
+
+// `static double ks_<name>(double a0, ...)`
+static void emit_signature(Cgen* cg, u32 index) {
+    writer_str(cg->out, "static double ");
+    emit_function_name(cg, index);
+    u32 paramsCount = cg->ir->functions[index]->paramsCount;
+    writer_str(cg->out, paramsCount ? "(" : "(void");
+    for (u32 i = 0; i < paramsCount; i++) {
+        emit(cg, i ? ", double a%u" : "double a%u", i);
+    }
+    writer_char(cg->out, ')');
+}
+
+// Assign the phis of `target` for the edge from `block`. The copies are
+// parallel, so with more than one phi they go through temporaries.
+static void emit_edge(Cgen* cg, const IrFunction* fn, u32 block, u32 target, bool second) {
+    const IrBlock* to = &fn->blocks[target];
+    u32 edge = 0;
+    while (to->preds[edge] != block) {
+        edge++;
+    }
+    if (second) {
+        // Both branch targets are `target`: the second edge is listed next.
+        edge++;
+        while (to->preds[edge] != block) {
+            edge++;
+        }
+    }
+    u32 phis = 0;
+    while (phis < to->instsCount && fn->insts[to->insts[phis]].op == IrPhi) {
+        phis++;
+    }
+    for (u32 i = 0; i < phis; i++) {
+        const IrInst* phi = &fn->insts[to->insts[i]];
+        Operand incoming = value_operand(fn, fn->operands[phi->value.phi + edge]);
+        if (phis == 1) {
+            emit(cg, "v%u = %s; ", to->insts[i], incoming.text);
+        } else {
+            emit(cg, "p%u = %s; ", i, incoming.text);
+        }
+    }
+    for (u32 i = 0; phis > 1 && i < phis; i++) {
+        emit(cg, "v%u = p%u; ", to->insts[i], i);
+    }
+    emit(cg, "goto b%u;", target);
+}
+
+// The relocation through which cgen_unit() calls `callee`, added on first
+// use. Only self-calls with the right arity are made directly.
+static u32 relocation(Cgen* cg, const IrInst* call) {
+    u32 callee = call->value.call.callee;
+    if (callee == cg->unit && call->value.call.count == cg->ir->functions[callee]->paramsCount) {
+        return IR_NONE;
+    }
+    for (u32 i = 0; i < cg->relocsCount; i++) {
+        if (cg->relocs[i] == callee) {
+            return i;
+        }
+    }
+    cg->relocs[cg->relocsCount] = callee;
+    return cg->relocsCount++;
+}
+
+// `ks_call(ks_ctx, ks_callees[k], (const double[]) { args }, count)`. The
+// evaluator runs the callee; a tail call goes through `ks_tail` instead,
+// which hands it back to the evaluator to run once this function returns.
+static void emit_relocated_call(Cgen* cg, const IrFunction* fn, const IrInst* inst, IrValue value, u32 reloc, bool tail) {
+    if (tail) {
+        emit(cg, "    return ks_tail(ks_ctx, ks_callees[%u], ", reloc);
+    } else {
+        emit(cg, "    v%u = ks_call(ks_ctx, ks_callees[%u], ", value, reloc);
+    }
+    u32 count = inst->value.call.count;
+    writer_str(cg->out, count ? "(const double[]) { " : "(const double*)0");
+    for (u32 i = 0; i < count; i++) {
+        Operand arg = value_operand(fn, fn->operands[inst->value.call.first + i]);
+        emit(cg, i ? ", %s" : "%s", arg.text);
+    }
+    emit(cg, count ? " }, %u);\n" : ", %u);\n", count);
+    if (!tail) {
+        // Stop where the evaluator would, on the first error.
+        writer_str(cg->out, "    if (*ks_error) return 0.0;\n");
+    }
+}
+
+// A call in tail position is returned directly, so the host compiler can
+// turn it into a jump that reuses the frame.
+static void cgen_inst(Cgen* cg, const IrFunction* fn, IrValue value, bool tail) {
+    static const char binops[] = { [IrAdd] = '+', [IrSub] = '-', [IrMul] = '*', [IrLess] = '<' };
+    const IrInst* inst = &fn->insts[value];
+    switch (inst->op) {
+    case IrConst:
+    case IrParam:
+    case IrPhi:
+        return;
+    case IrAdd:
+    case IrSub:
+    case IrMul:
+    case IrLess: {
+        Operand lhs = value_operand(fn, inst->value.operands[0]);
+        Operand rhs = value_operand(fn, inst->value.operands[1]);
+        emit(cg, "    v%u = %s %c %s;\n", value, lhs.text, binops[inst->op], rhs.text);
+        return;
+    }
+    case IrCall: {
+        u32 reloc = cg->unit != IR_NONE ? relocation(cg, inst) : IR_NONE;
+        if (reloc != IR_NONE) {
+            emit_relocated_call(cg, fn, inst, value, reloc, tail);
+            return;
+        }
+        if (tail) {
+            writer_str(cg->out, "    return ");
+        } else {
+            emit(cg, "    v%u = ", value);
+        }
+        emit_function_name(cg, inst->value.call.callee);
+        writer_char(cg->out, '(');
+        for (u32 i = 0; i < inst->value.call.count; i++) {
+            Operand arg = value_operand(fn, fn->operands[inst->value.call.first + i]);
+            emit(cg, i ? ", %s" : "%s", arg.text);
+        }
+        writer_str(cg->out, ");\n");
+        if (cg->drains && !tail) {
+            // The self-call may have handed a tail call back and returned
+            // 0; its result is that of the tail call.
+            emit(cg, "    if (*ks_pending != 0x%xu) v%u = ks_drain(ks_ctx, v%u);\n", IR_NONE, value, value);
+            writer_str(cg->out, "    if (*ks_error) return 0.0;\n");
+        }
+        return;
+    }
+    }
+}
+
+static void cgen_function(Cgen* cg, u32 index) {
+    const IrFunction* fn = cg->ir->functions[index];
+    emit_signature(cg, index);
+    writer_str(cg->out, " {\n");
+
+    // One local per computed value, declared up front so labels can jump
+    // anywhere.
+    bool any = false;
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        IrValue tail = block->dead ? IR_NONE : ir_tail_call(fn, bi);
+        for (u32 i = 0; !block->dead && i < block->instsCount; i++) {
+            IrOp op = fn->insts[block->insts[i]].op;
+            if (op != IrConst && op != IrParam && block->insts[i] != tail) {
+                emit(cg, any ? ", v%u" : "    double v%u", block->insts[i]);
+                any = true;
+            }
+        }
+    }
+    if (any) {
+        writer_str(cg->out, ";\n");
+    }
+    for (u32 i = 0; fn->maxPhis > 1 && i < fn->maxPhis; i++) {
+        emit(cg, i ? ", p%u" : "    double p%u", i);
+    }
+    if (fn->maxPhis > 1) {
+        writer_str(cg->out, ";\n");
+    }
+    if (cg->recurses) {
+        // Recursion that stays in machine code never passes the evaluator's
+        // own check, so it stops at the same limit here.
+        writer_str(cg->out, "    if ((const char*)__builtin_frame_address(0) < *ks_stack_limit) return ks_overflow(ks_ctx);\n");
+    }
+
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        if (block->dead) {
+            continue;
+        }
+        if (block->predsCount > 0) {
+            emit(cg, "b%u:;\n", bi);
+        }
+        IrValue tail = ir_tail_call(fn, bi);
+        for (u32 i = 0; i < block->instsCount; i++) {
+            cgen_inst(cg, fn, block->insts[i], block->insts[i] == tail);
+        }
+        if (tail != IR_NONE) {
+            continue;
+        }
+        const IrTerm* term = &block->term;
+        switch (term->kind) {
+        case IrReturn:
+            emit(cg, "    return %s;\n", value_operand(fn, term->value).text);
+            break;
+        case IrJump:
+            writer_str(cg->out, "    ");
+            emit_edge(cg, fn, bi, term->targets[0], false);
+            writer_char(cg->out, '\n');
+            break;
+        case IrBranch:
+            emit(cg, "    if (%s != 0.0) { ", value_operand(fn, term->value).text);
+            emit_edge(cg, fn, bi, term->targets[0], false);
+            writer_str(cg->out, " }\n    ");
+            emit_edge(cg, fn, bi, term->targets[1], term->targets[0] == term->targets[1]);
+            writer_char(cg->out, '\n');
+            break;
+        }
+    }
+    writer_str(cg->out, "}\n\n");
+}
+
+// ---- Program ----
+
+// Externs the generated code can call without user-supplied objects, and
+// the C that provides the ones libm does not.
+static const struct {
+    const char* name;
+    usize argsCount;
+    const char* definition; // NULL for libm, declared from argsCount
+} cgenBuiltins[] = {
+    { "sin", 1, NULL },
+    { "cos", 1, NULL },
+    { "sqrt", 1, NULL },
+    { "exp", 1, NULL },
+    { "log", 1, NULL },
+    { "fabs", 1, NULL },
+    { "floor", 1, NULL },
+    { "pow", 2, NULL },
+    { "putchard", 1, "static double putchard(double c) {\n    putchar((char)c);\n    return 0;\n}\n" },
+    { "printd", 1, "static double printd(double x) {\n    printf(\"%f\\n\", x);\n    return 0;\n}\n" },
+};
+
+#define CGEN_BUILTINS_COUNT (sizeof(cgenBuiltins) / sizeof(cgenBuiltins[0]))
+
+static isize find_cgen_builtin(const char* name, usize argsCount) {
+    for (usize i = 0; i < CGEN_BUILTINS_COUNT; i++) {
+        if (cgenBuiltins[i].argsCount == argsCount && strcmp(cgenBuiltins[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The C library functions the program calls itself, and its entry point.
+// The prelude declares them rather than include their headers, so externs
+// may take any other name; one of these would redeclare it.
+static const char* const cgenReserved[] = { "main", "printf", "putchar" };
+
+#define CGEN_RESERVED_COUNT (sizeof(cgenReserved) / sizeof(cgenReserved[0]))
+
+// The first extern of `m` that takes a reserved name, or NULL.
+static const char* find_reserved_extern(const IrModule* m) {
+    for (u32 f = 0; f < m->count; f++) {
+        for (usize i = 0; m->functions[f]->isExtern && i < CGEN_RESERVED_COUNT; i++) {
+            if (strcmp(m->functions[f]->name, cgenReserved[i]) == 0) {
+                return m->functions[f]->name;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void cgen_prelude(Cgen* cg) {
+    writer_str(cg->out, "/* Generated by kaleidoscopec --emit-c. */\n");
+    writer_str(cg->out, "int printf(const char* format, ...);\nint putchar(int c);\n\n");
+
+    bool used[CGEN_BUILTINS_COUNT] = { 0 };
+    bool userExterns = false;
+    for (u32 f = 0; f < cg->ir->count; f++) {
+        const IrFunction* fn = cg->ir->functions[f];
+        if (!fn->isExtern) {
+            continue;
+        }
+        isize builtin = find_cgen_builtin(fn->name, fn->paramsCount);
+        if (builtin >= 0) {
+            used[builtin] = true;
+            continue;
+        }
+        // Supplied by the objects the program is linked with.
+        emit(cg, "extern double %s(", fn->name);
+        for (u32 a = 0; a < fn->paramsCount; a++) {
+            writer_str(cg->out, a ? ", double" : "double");
+        }
+        writer_str(cg->out, fn->paramsCount ? ");\n" : "void);\n");
+        userExterns = true;
+    }
+    if (userExterns) {
+        writer_char(cg->out, '\n');
+    }
+    bool libm = false;
+    for (usize i = 0; i < CGEN_BUILTINS_COUNT; i++) {
+        if (used[i] && !cgenBuiltins[i].definition) {
+            emit(cg, cgenBuiltins[i].argsCount == 2 ? "double %s(double, double);\n" : "double %s(double);\n", cgenBuiltins[i].name);
+            libm = true;
+        }
+    }
+    if (libm) {
+        writer_char(cg->out, '\n');
+    }
+    for (usize i = 0; i < CGEN_BUILTINS_COUNT; i++) {
+        if (used[i] && cgenBuiltins[i].definition) {
+            writer_str(cg->out, cgenBuiltins[i].definition);
+            writer_char(cg->out, '\n');
+        }
+    }
+}
+
+// Write the C for `items` to `out`. Returns false with cg->error set if
+// the program does not resolve; nothing is written then.
+bool cgen_program(Cgen* cg, Writer* out, const ItemAST* items, usize itemsCount, bool optimize) {
+    *cg = (Cgen) { .out = out, .ir = &cg->module, .unit = IR_NONE };
+    ir_module_init(&cg->module);
+    cg->module.optimize = optimize;
+    if (!ir_lower_program(&cg->module, items, itemsCount, &cg->error, &cg->errorFunction)) {
+        return false;
+    }
+    const char* reserved = find_reserved_extern(&cg->module);
+    if (reserved) {
+        cg->error = "Extern name is reserved in C output";
+        cg->errorFunction = reserved;
+        return false;
+    }
+    cgen_prelude(cg);
+
+    // Forward declarations, so definitions may call each other in any order.
+    const IrModule* m = &cg->module;
+    for (u32 f = 0; f < m->count; f++) {
+        if (m->functions[f]->defined) {
+            emit_signature(cg, f);
+            writer_str(cg->out, ";\n");
+        }
+    }
+    writer_char(cg->out, '\n');
+    for (u32 f = 0; f < m->count; f++) {
+        if (m->functions[f]->defined) {
+            cgen_function(cg, f);
+        }
+    }
+
+    writer_str(cg->out, "int main(void) {\n");
+    for (u32 f = 0; f < m->count; f++) {
+        if (m->functions[f]->defined && !m->functions[f]->name) {
+            emit(cg, "    printf(\"%%f\\n\", ks__expr%u());\n", f);
+        }
+    }
+    writer_str(cg->out, "    return 0;\n}\n");
+    return true;
+}
+
+void cgen_free(Cgen* cg) {
+    ir_module_free(&cg->module);
+}
+
+// ---- Units ----
+
+// Write function `index` of `m` alone as a C translation unit, to be built
+// as a shared object that the evaluator loads and links (see cache.c). It
+// exports `ks_entry(args)`, and `ks_key` to check the object against. The
+// functions it calls are its relocations: `ks_symbols` names them, and the
+// loader stores their module indices in `ks_callees` and the evaluator's
+// entry points in `ks_call`, `ks_tail`, `ks_drain`, `ks_overflow`, `ks_ctx`,
+// `ks_pending`, `ks_error` and `ks_stack_limit`. A function that hands tail
+// calls back through `ks_tail` returns 0 in their place, so a direct
+// self-call that is not itself in tail position checks `ks_pending` and
+// has `ks_drain` make the call. A function that calls itself outside tail
+// position checks its frame against `ks_stack_limit` on entry.
+void cgen_unit(Writer* out, const IrModule* m, u32 index, u64 key) {
+    const IrFunction* fn = m->functions[index];
+    Cgen cg = { .out = out, .ir = m, .unit = index };
+    cg.relocs = malloc(sizeof(u32) * (fn->instsCount + 1));
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        IrValue tail = block->dead ? IR_NONE : ir_tail_call(fn, bi);
+        for (u32 i = 0; !block->dead && i < block->instsCount; i++) {
+            const IrInst* inst = &fn->insts[block->insts[i]];
+            if (inst->op != IrCall) {
+                continue;
+            }
+            bool direct = relocation(&cg, inst) == IR_NONE;
+            cg.drains |= !direct && block->insts[i] == tail;
+            cg.recurses |= direct && block->insts[i] != tail;
+        }
+    }
+
+    writer_str(out, "/* Generated by kaleidoscopec --native-cache. */\n");
+    writer_str(out, "#include <math.h>\n\n");
+    writer_str(out, "typedef double (*KsCall)(void* ctx, unsigned callee, const double* args, unsigned argsCount);\n");
+    writer_str(out, "typedef double (*KsDrain)(void* ctx, double result);\n");
+    writer_str(out, "typedef double (*KsOverflow)(void* ctx);\n\n");
+    emit(&cg, "const unsigned long long ks_key = 0x%016llxull;\n", (unsigned long long)key);
+    writer_str(out, "const char* const ks_symbols[] = { ");
+    for (u32 i = 0; i < cg.relocsCount; i++) {
+        emit(&cg, "\"%s\", ", m->functions[cg.relocs[i]]->name);
+    }
+    emit(&cg, "0 };\nunsigned ks_callees[%u];\n", cg.relocsCount + 1);
+    writer_str(out, "KsCall ks_call;\nKsCall ks_tail;\nKsDrain ks_drain;\nKsOverflow ks_overflow;\nvoid* ks_ctx;\n");
+    writer_str(out, "const unsigned* ks_pending;\nconst char* const* ks_error;\nconst char* const* ks_stack_limit;\n\n");
+
+    cgen_function(&cg, index);
+    writer_str(out, "double ks_entry(const double* args) {\n    return ks_fn(");
+    for (u32 i = 0; i < fn->paramsCount; i++) {
+        emit(&cg, i ? ", args[%u]" : "args[%u]", i);
+    }
+    writer_str(out, ");\n}\n");
+    free(cg.relocs);
+}
+
+// ---- Host compiler ----
+
+// Run the host compiler ($CC, default cc) with `args`, which end in NULL.
+// Returns its exit status; 127 if it could not be run.
+static int run_cc(const char* const* args) {
+    const char* cc = getenv("CC");
+    if (!cc || !*cc) {
+        cc = "cc";
+    }
+    const char* argv[16] = { cc };
+    for (usize i = 0; args[i]; i++) {
+        argv[i + 1] = args[i];
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(cc, (char* const*)argv);
+        perror(cc);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        perror("waitpid");
+        return 1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// Build an executable from generated C at -O2.
+int cgen_build_executable(const char* cPath, const char* exePath) {
+    const char* args[] = { "-O2", "-o", exePath, cPath, "-lm", NULL };
+    return run_cc(args);
+}
+
+// Build a shared object from a cgen_unit(), for the machine it runs on.
+int cgen_build_shared(const char* cPath, const char* soPath) {
+    const char* args[] = { CGEN_SHARED_FLAGS, "-o", soPath, cPath, NULL };
+    return run_cc(args);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "arena.h"
+#include "ir.h"
+#include "parser.h"
+#include "types.h"
+#include "writer.h"
+#include <stdbool.h>
+
+// Ahead-of-time backend: lowers a whole program through the IR to one
+// standalone C translation unit. Definitions become `static double`
+// functions whose blocks are labels, externs map to libm or to symbols
+// supplied at link time, and top-level expressions run in order from
+// main(), printed like --eval prints them.
+typedef struct {
+    Writer* out;
+    IrModule module;
+    const IrModule* ir; // generated from: `module`, or cgen_unit()'s
+    // cgen_unit(): the function generated, or IR_NONE for a whole
+    // program, and the callees it calls through relocations.
+    u32 unit;
+    u32* relocs;
+    u32 relocsCount;
+    bool drains; // the unit hands tail calls back, see cgen_unit()
+    bool recurses; // the unit calls itself outside tail position
+    const char* error;
+    const char* errorFunction; // NULL for a top-level expression
+} Cgen;
+
+// Host compiler flags for cgen_build_shared(). They are part of the key of
+// every cached object, as code built with them is specific to the CPU.
+#define CGEN_SHARED_FLAGS "-O2", "-march=native", "-fPIC", "-shared"
+
+bool cgen_program(Cgen* cg, Writer* out, const ItemAST* items, usize itemsCount, bool optimize);
+void cgen_free(Cgen* cg);
+void cgen_unit(Writer* out, const IrModule* m, u32 index, u64 key);
+int cgen_build_executable(const char* cPath, const char* exePath);
+int cgen_build_shared(const char* cPath, const char* soPath);
@@ -0,0 +1,746 @@
+#include "eval.h"
+#include "arena.h"
+#include "cache.h"
+#include "parser.h"
+#include "profile.h"
+#include <alloca.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// ---- Builtins ----
+
+static double native_sin(const double* args) { return sin(args[0]); }
+static double native_cos(const double* args) { return cos(args[0]); }
+static double native_sqrt(const double* args) { return sqrt(args[0]); }
+static double native_exp(const double* args) { return exp(args[0]); }
+static double native_log(const double* args) { return log(args[0]); }
+static double native_fabs(const double* args) { return fabs(args[0]); }
+static double native_floor(const double* args) { return floor(args[0]); }
+static double native_pow(const double* args) { return pow(args[0], args[1]); }
+
+static double native_putchard(const double* args) {
+    fputc((char)args[0], stdout);
+    return 0;
+}
+
+static double native_printd(const double* args) {
+    printf("%f\n", args[0]);
+    return 0;
+}
+
+static const struct {
+    const char* name;
+    usize argsCount;
+    NativeFn fn;
+} builtins[] = {
+    { "sin", 1, native_sin },
+    { "cos", 1, native_cos },
+    { "sqrt", 1, native_sqrt },
+    { "exp", 1, native_exp },
+    { "log", 1, native_log },
+    { "fabs", 1, native_fabs },
+    { "floor", 1, native_floor },
+    { "pow", 2, native_pow },
+    { "putchard", 1, native_putchard },
+    { "printd", 1, native_printd },
+};
+
+static NativeFn find_builtin(const char* name, usize argsCount) {
+    for (usize i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (builtins[i].argsCount == argsCount && strcmp(builtins[i].name, name) == 0) {
+            return builtins[i].fn;
+        }
+    }
+    return NULL;
+}
+
+// ---- Function table ----
+
+u64 hash_name(const char* name) {
+    u64 hash = 14695981039346656037ull;
+    for (; *name; name++) {
+        hash = (hash ^ (u8)*name) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// The stack assumed when it has no limit: what the limit usually is.
+#define EVAL_UNLIMITED_STACK ((usize)8 << 20)
+
+void evaluator_init(Evaluator* ev) {
+    ev->arena = (Arena) { 0 };
+    ir_module_init(&ev->module);
+    ev->slots = NULL;
+    ev->slotsCapacity = 0;
+    ev->anonymous = ir_function(&ev->module, NULL);
+    ev->profiler = NULL;
+    ev->cache = NULL;
+    ev->tailCallee = IR_NONE;
+    ev->tailArgs = NULL;
+    ev->tailArgsCount = 0;
+    ev->tailArgsCapacity = 0;
+    struct rlimit stack;
+    bool limited = getrlimit(RLIMIT_STACK, &stack) == 0 && stack.rlim_cur != RLIM_INFINITY;
+    ev->stackSize = limited ? stack.rlim_cur : EVAL_UNLIMITED_STACK;
+    ev->stackLimit = NULL;
+    ev->error = NULL;
+}
+
+void evaluator_free(Evaluator* ev) {
+    for (u32 i = 0; i < ev->slotsCapacity; i++) {
+        free(ev->slots[i].ops);
+        free(ev->slots[i].args);
+    }
+    free(ev->slots);
+    ev->slots = NULL;
+    free(ev->tailArgs);
+    ev->tailArgs = NULL;
+    ir_module_free(&ev->module);
+    arena_free(&ev->arena);
+}
+
+static EvalSlot* get_slot(Evaluator* ev, u32 index) {
+    if (index >= ev->slotsCapacity) {
+        u32 capacity = ev->slotsCapacity ? ev->slotsCapacity : 64;
+        while (capacity <= index) {
+            capacity *= 2;
+        }
+        ev->slots = realloc(ev->slots, sizeof(EvalSlot) * capacity);
+        memset(ev->slots + ev->slotsCapacity, 0, sizeof(EvalSlot) * (capacity - ev->slotsCapacity));
+        ev->slotsCapacity = capacity;
+    }
+    return &ev->slots[index];
+}
+
+// ---- Compiling ----
+
+typedef enum {
+    OpConst,
+    OpParam,
+    OpAdd,
+    OpSub,
+    OpMul,
+    OpLess,
+    OpCall,
+    OpTailCall,
+    OpMove,
+    OpJump,
+    OpBranchFalse,
+    OpReturn
+} EvalOpKind;
+
+// Registers are IR values, plus one scratch register per phi for parallel
+// copies. Blocks are laid out in order, phis become copies on the edges
+// into their block and constants are loaded once on entry. A call whose
+// result is returned becomes an OpTailCall, which runs the callee in the
+// caller's frame.
+struct EvalOp {
+    EvalOpKind kind;
+    u32 dst;
+    union {
+        double number; // OpConst
+        u32 param; // OpParam
+        u32 operands[2]; // OpAdd, OpSub, OpMul, OpLess; source of OpMove and OpReturn
+        struct {
+            u32 callee;
+            u32 first; // in EvalSlot.args
+            u32 count;
+        } call;
+        struct {
+            u32 cond; // OpBranchFalse
+            u32 target; // op index
+        } jump;
+    } value;
+};
+
+typedef struct {
+    EvalOp* ops;
+    u32 count;
+    u32 capacity;
+} EvalOps;
+
+static u32 push_op(EvalOps* ops, EvalOp op) {
+    if (ops->count == ops->capacity) {
+        ops->capacity = ops->capacity ? ops->capacity * 2 : 64;
+        ops->ops = realloc(ops->ops, sizeof(EvalOp) * ops->capacity);
+    }
+    ops->ops[ops->count] = op;
+    return ops->count++;
+}
+
+// Copies for the phis of `target` along the edge from `block`; the second
+// edge when both branch targets are `target`.
+static void compile_edge(EvalOps* ops, const IrFunction* fn, u32 block, u32 target, bool second) {
+    const IrBlock* to = &fn->blocks[target];
+    u32 edge = 0;
+    while (to->preds[edge] != block) {
+        edge++;
+    }
+    if (second) {
+        edge++;
+        while (to->preds[edge] != block) {
+            edge++;
+        }
+    }
+    u32 phis = 0;
+    while (phis < to->instsCount && fn->insts[to->insts[phis]].op == IrPhi) {
+        phis++;
+    }
+    for (u32 i = 0; i < phis; i++) {
+        IrValue src = fn->operands[fn->insts[to->insts[i]].value.phi + edge];
+        u32 dst = phis == 1 ? to->insts[i] : fn->instsCount + i;
+        push_op(ops, (EvalOp) { .kind = OpMove, .dst = dst, .value = { .operands = { src } } });
+    }
+    for (u32 i = 0; phis > 1 && i < phis; i++) {
+        push_op(ops, (EvalOp) { .kind = OpMove, .dst = to->insts[i], .value = { .operands = { fn->instsCount + i } } });
+    }
+}
+
+static u32 next_live_block(const IrFunction* fn, u32 block) {
+    do {
+        block++;
+    } while (block < fn->blocksCount && fn->blocks[block].dead);
+    return block;
+}
+
+// Compile the current body of function `index` into its slot.
+static void compile_function(Evaluator* ev, u32 index) {
+    const IrFunction* fn = ev->module.functions[index];
+    EvalOps ops = { 0 };
+    u32* args = malloc(sizeof(u32) * (fn->operandsCount + 1));
+    u32 argsCount = 0;
+    u32* starts = malloc(sizeof(u32) * fn->blocksCount);
+    u32* jumps = malloc(sizeof(u32) * fn->blocksCount * 2); // ops whose target is a block index
+    u32 jumpsCount = 0;
+
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        for (u32 i = 0; !block->dead && i < block->instsCount; i++) {
+            const IrInst* inst = &fn->insts[block->insts[i]];
+            if (inst->op == IrConst) {
+                push_op(&ops, (EvalOp) { .kind = OpConst, .dst = block->insts[i], .value = { .number = inst->value.number } });
+            }
+        }
+    }
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        if (block->dead) {
+            continue;
+        }
+        starts[bi] = ops.count;
+        bool tail = false;
+        for (u32 i = 0; i < block->instsCount; i++) {
+            IrValue v = block->insts[i];
+            const IrInst* inst = &fn->insts[v];
+            switch (inst->op) {
+            case IrConst:
+            case IrPhi:
+                break;
+            case IrParam:
+                push_op(&ops, (EvalOp) { .kind = OpParam, .dst = v, .value = { .param = inst->value.param } });
+                break;
+            case IrAdd:
+            case IrSub:
+            case IrMul:
+            case IrLess:
+                push_op(&ops, (EvalOp) { .kind = OpAdd + (inst->op - IrAdd), .dst = v, .value = { .operands = { inst->value.operands[0], inst->value.operands[1] } } });
+                break;
+            case IrCall: {
+                tail = ir_tail_call(fn, bi) == v;
+                EvalOp call = { .kind = tail ? OpTailCall : OpCall, .dst = v };
+                call.value.call.callee = inst->value.call.callee;
+                call.value.call.first = argsCount;
+                call.value.call.count = inst->value.call.count;
+                memcpy(args + argsCount, fn->operands + inst->value.call.first, sizeof(u32) * inst->value.call.count);
+                argsCount += inst->value.call.count;
+                push_op(&ops, call);
+                break;
+            }
+            }
+        }
+
+        if (tail) {
+            continue;
+        }
+        const IrTerm* term = &block->term;
+        u32 next = next_live_block(fn, bi);
+        switch (term->kind) {
+        case IrReturn:
+            push_op(&ops, (EvalOp) { .kind = OpReturn, .value = { .operands = { term->value } } });
+            break;
+        case IrJump:
+            compile_edge(&ops, fn, bi, term->targets[0], false);
+            if (term->targets[0] != next) {
+                jumps[jumpsCount++] = push_op(&ops, (EvalOp) { .kind = OpJump, .value = { .jump = { .target = term->targets[0] } } });
+            }
+            break;
+        case IrBranch: {
+            u32 branch = push_op(&ops, (EvalOp) { .kind = OpBranchFalse, .value = { .jump = { .cond = term->value } } });
+            compile_edge(&ops, fn, bi, term->targets[0], false);
+            jumps[jumpsCount++] = push_op(&ops, (EvalOp) { .kind = OpJump, .value = { .jump = { .target = term->targets[0] } } });
+            ops.ops[branch].value.jump.target = ops.count;
+            compile_edge(&ops, fn, bi, term->targets[1], term->targets[0] == term->targets[1]);
+            if (term->targets[1] != next) {
+                jumps[jumpsCount++] = push_op(&ops, (EvalOp) { .kind = OpJump, .value = { .jump = { .target = term->targets[1] } } });
+            }
+            break;
+        }
+        }
+    }
+    for (u32 i = 0; i < jumpsCount; i++) {
+        ops.ops[jumps[i]].value.jump.target = starts[ops.ops[jumps[i]].value.jump.target];
+    }
+    free(jumps);
+    free(starts);
+
+    EvalSlot* slot = get_slot(ev, index);
+    free(slot->ops);
+    free(slot->args);
+    slot->ops = ops.ops;
+    slot->args = args;
+    slot->registers = fn->instsCount + fn->maxPhis;
+    slot->maxCallArgs = fn->maxCallArgs;
+}
+
+static void drop_code(EvalSlot* slot) {
+    free(slot->ops);
+    free(slot->args);
+    slot->ops = NULL;
+    slot->args = NULL;
+    slot->machine = NULL;
+}
+
+// Give function `index` a new body. It is lowered, optimized and compiled
+// when first called, so definitions that are never called cost nothing
+// more than keeping their AST.
+static void define_function(Evaluator* ev, u32 index, const FunctionAST* ast) {
+    ir_set_body(&ev->module, index, ast);
+    drop_code(get_slot(ev, index));
+}
+
+// ---- Persisting definitions ----
+
+static const char* clone_str(Arena* a, const char* str) {
+    usize length = strlen(str);
+    char* copy = arena_alloc(a, length + 1);
+    memcpy(copy, str, length + 1);
+    return copy;
+}
+
+static ExprAST* clone_expr(Arena* a, const ExprAST* expr) {
+    ExprAST* copy = arena_alloc(a, sizeof(ExprAST));
+    *copy = *expr;
+    switch (expr->type) {
+    case ExprNumberType:
+        break;
+    case ExprVariableType:
+        copy->value.variableName = clone_str(a, expr->value.variableName);
+        break;
+    case ExprBinopType:
+        copy->value.binop.lhs = clone_expr(a, expr->value.binop.lhs);
+        copy->value.binop.rhs = clone_expr(a, expr->value.binop.rhs);
+        break;
+    case ExprCallType:
+        copy->value.call.callee = clone_str(a, expr->value.call.callee);
+        copy->value.call.args = arena_alloc(a, sizeof(ExprAST*) * expr->value.call.argsCount);
+        for (usize i = 0; i < expr->value.call.argsCount; i++) {
+            copy->value.call.args[i] = clone_expr(a, expr->value.call.args[i]);
+        }
+        break;
+    case ExprIfType:
+        copy->value.conditional.cond = clone_expr(a, expr->value.conditional.cond);
+        copy->value.conditional.then = clone_expr(a, expr->value.conditional.then);
+        copy->value.conditional.otherwise = clone_expr(a, expr->value.conditional.otherwise);
+        break;
+    }
+    return copy;
+}
+
+static FunctionAST* clone_function(Arena* a, const FunctionAST* fn) {
+    FunctionAST* copy = arena_alloc(a, sizeof(FunctionAST));
+    copy->proto.name = clone_str(a, fn->proto.name);
+    copy->proto.argsCount = fn->proto.argsCount;
+    copy->proto.args = arena_alloc(a, sizeof(char*) * fn->proto.argsCount);
+    for (usize i = 0; i < fn->proto.argsCount; i++) {
+        copy->proto.args[i] = clone_str(a, fn->proto.args[i]);
+    }
+    copy->body = fn->body ? clone_expr(a, fn->body) : NULL;
+    copy->start = fn->start;
+    return copy;
+}
+
+// ---- Evaluation ----
+
+static double eval_error(Evaluator* ev, const char* msg) {
+    if (!ev->error) {
+        ev->error = msg;
+    }
+    return 0;
+}
+
+// Whether a frame at `frame` is past ev->stackLimit, so that deep
+// recursion fails with an error rather than overflowing the stack.
+static inline bool stack_exhausted(Evaluator* ev, uptr frame) {
+    if (frame >= (uptr)ev->stackLimit) {
+        return false;
+    }
+    eval_error(ev, "Recursion too deep");
+    return true;
+}
+
+static double run_function(Evaluator* ev, const EvalSlot* slot, const double* args);
+static double run_profiled(Evaluator* ev, const EvalSlot* slot, const double* args, u32 depth);
+static double run_machine(Evaluator* ev, const EvalSlot* slot, const double* args, u32 depth);
+
+// Lower, optimize and compile `callee` for its first call: to machine code
+// from the native cache, if there is one, or else for the interpreter.
+// Top-level expressions run once and are always interpreted.
+static bool materialize_function(Evaluator* ev, u32 callee) {
+    Profiler* p = ev->profiler;
+    u32 depth = p ? profiler_depth(p) : 0;
+    if (p) {
+        profiler_enter(p, depth, PROFILE_FRAME_COMPILE);
+    }
+    bool ok = ir_materialize(&ev->module, callee, &ev->error);
+    if (ok) {
+        NativeFn machine = ev->cache && callee != ev->anonymous ? native_cache_load(ev->cache, ev, callee) : NULL;
+        if (machine) {
+            get_slot(ev, callee)->machine = machine;
+        } else {
+            compile_function(ev, callee);
+        }
+    }
+    if (p) {
+        profiler_leave(p, depth);
+    }
+    return ok;
+}
+
+// The slot a call to `callee` runs, compiling the callee on first use.
+// NULL with ev->error set if the call cannot be made.
+static const EvalSlot* resolve_call(Evaluator* ev, u32 callee, u32 argsCount) {
+    const IrFunction* fn = ev->module.functions[callee];
+    if (!fn->defined && !fn->isExtern) {
+        eval_error(ev, "Unknown function referenced");
+        return NULL;
+    }
+    if (fn->paramsCount != argsCount) {
+        eval_error(ev, "Incorrect # arguments passed");
+        return NULL;
+    }
+    if (!fn->isExtern && !ev->slots[callee].ops && !ev->slots[callee].machine && !materialize_function(ev, callee)) {
+        return NULL;
+    }
+    return &ev->slots[callee];
+}
+
+// The interpreter comes in two instances: call_function() and
+// run_function() as it always was, and call_profiled() and run_profiled()
+// that also keep each call on the profiler's shadow stack, at the `depth`
+// they pass down. eval_item() picks one per top-level expression, so
+// without a profiler the calls do not so much as test for one; `profiled`
+// is a constant in each instance.
+#define EVAL_INSTANCE static inline __attribute__((always_inline))
+
+EVAL_INSTANCE double call_function_as(Evaluator* ev, u32 callee, const double* args, u32 argsCount, u32 depth, bool profiled) {
+    if (profiled) {
+        profiler_enter(ev->profiler, depth, callee);
+    }
+    const EvalSlot* slot = resolve_call(ev, callee, argsCount);
+    double result = 0;
+    if (slot) {
+        result = slot->ops ? (profiled ? run_profiled(ev, slot, args, depth) : run_function(ev, slot, args)) : slot->machine ? run_machine(ev, slot, args, depth) : slot->native(args);
+    }
+    if (profiled) {
+        profiler_leave(ev->profiler, depth);
+    }
+    return result;
+}
+
+static double call_function(Evaluator* ev, u32 callee, const double* args, u32 argsCount) {
+    return call_function_as(ev, callee, args, argsCount, 0, false);
+}
+
+static double call_profiled(Evaluator* ev, u32 callee, const double* args, u32 argsCount, u32 depth) {
+    return call_function_as(ev, callee, args, argsCount, depth, true);
+}
+
+EVAL_INSTANCE double run_function_as(Evaluator* ev, const EvalSlot* slot, const double* args, u32 depth, bool profiled) {
+    // One frame: registers, then outgoing arguments. Tail calls run in the
+    // same frame, growing it only when a callee needs more room than any
+    // function run in it so far, so chains of them use constant stack.
+    u32 frameSize = slot->registers + slot->maxCallArgs;
+    double* r = alloca(sizeof(double) * frameSize);
+    if (stack_exhausted(ev, (uptr)r)) {
+        return 0;
+    }
+    double* callArgs = r + slot->registers;
+    double* params = NULL; // arguments of the last tail call
+    u32 paramsCapacity = 0;
+    for (u32 pc = 0;; pc++) {
+        const EvalOp* op = &slot->ops[pc];
+        switch (op->kind) {
+        case OpConst:
+            r[op->dst] = op->value.number;
+            break;
+        case OpParam:
+            r[op->dst] = args[op->value.param];
+            break;
+        case OpAdd:
+            r[op->dst] = r[op->value.operands[0]] + r[op->value.operands[1]];
+            break;
+        case OpSub:
+            r[op->dst] = r[op->value.operands[0]] - r[op->value.operands[1]];
+            break;
+        case OpMul:
+            r[op->dst] = r[op->value.operands[0]] * r[op->value.operands[1]];
+            break;
+        case OpLess:
+            r[op->dst] = r[op->value.operands[0]] < r[op->value.operands[1]] ? 1.0 : 0.0;
+            break;
+        case OpCall: {
+            const u32* argRegs = slot->args + op->value.call.first;
+            for (u32 a = 0; a < op->value.call.count; a++) {
+                callArgs[a] = r[argRegs[a]];
+            }
+            r[op->dst] = call_function_as(ev, op->value.call.callee, callArgs, op->value.call.count, profiler_callee_depth(depth), profiled);
+            if (ev->error) {
+                return 0;
+            }
+            break;
+        }
+        case OpTailCall: {
+            u32 count = op->value.call.count;
+            const u32* argRegs = slot->args + op->value.call.first;
+            for (u32 a = 0; a < count; a++) {
+                callArgs[a] = r[argRegs[a]];
+            }
+            if (profiled) {
+                profiler_enter(ev->profiler, depth, op->value.call.callee);
+            }
+            const EvalSlot* callee = resolve_call(ev, op->value.call.callee, count);
+            if (!callee) {
+                return 0;
+            }
+            if (!callee->ops) {
+                return callee->machine ? run_machine(ev, callee, callArgs, depth) : callee->native(callArgs);
+            }
+            if (count > paramsCapacity) {
+                paramsCapacity = count;
+                params = alloca(sizeof(double) * paramsCapacity);
+            }
+            memcpy(params, callArgs, sizeof(double) * count);
+            args = params;
+            if (callee->registers + callee->maxCallArgs > frameSize) {
+                frameSize = callee->registers + callee->maxCallArgs;
+                r = alloca(sizeof(double) * frameSize);
+            }
+            callArgs = r + callee->registers;
+            slot = callee;
+            pc = (u32)-1;
+            break;
+        }
+        case OpMove:
+            r[op->dst] = r[op->value.operands[0]];
+            break;
+        case OpJump:
+            pc = op->value.jump.target - 1;
+            break;
+        case OpBranchFalse:
+            if (r[op->value.jump.cond] == 0.0) {
+                pc = op->value.jump.target - 1;
+            }
+            break;
+        case OpReturn:
+            return r[op->value.operands[0]];
+        }
+    }
+}
+
+static double run_function(Evaluator* ev, const EvalSlot* slot, const double* args) {
+    return run_function_as(ev, slot, args, 0, false);
+}
+
+static double run_profiled(Evaluator* ev, const EvalSlot* slot, const double* args, u32 depth) {
+    return run_function_as(ev, slot, args, depth, true);
+}
+
+// ---- Machine code ----
+
+// The trampoline. Machine code cannot reuse its frame for a call to
+// another object, so it hands tail calls back instead and they run here,
+// in a loop, in constant stack. Only a chain that passes through the
+// interpreter and back nests a frame per round trip. `result` is what the
+// code returned, which stands if it handed back none.
+static double run_tail_calls(Evaluator* ev, double result) {
+    double* params = NULL;
+    u32 paramsCapacity = 0;
+    while (ev->tailCallee != IR_NONE) {
+        u32 callee = ev->tailCallee;
+        u32 count = ev->tailArgsCount;
+        ev->tailCallee = IR_NONE;
+        if (count > paramsCapacity) {
+            paramsCapacity = count;
+            params = alloca(sizeof(double) * paramsCapacity);
+        }
+        memcpy(params, ev->tailArgs, sizeof(double) * count);
+        if (ev->profiler) {
+            profiler_enter(ev->profiler, ev->profiler->nativeDepth, callee);
+        }
+        const EvalSlot* slot = resolve_call(ev, callee, count);
+        if (!slot) {
+            return 0;
+        }
+        if (slot->ops) {
+            return ev->profiler ? run_profiled(ev, slot, params, ev->profiler->nativeDepth) : run_function(ev, slot, params);
+        }
+        result = slot->machine ? slot->machine(params) : slot->native(params);
+    }
+    return result;
+}
+
+// Run a definition from the native cache, called at `depth`, and the tail
+// calls it hands back.
+static double run_machine(Evaluator* ev, const EvalSlot* slot, const double* args, u32 depth) {
+    if (stack_exhausted(ev, (uptr)__builtin_frame_address(0))) {
+        return 0;
+    }
+    Profiler* p = ev->profiler;
+    if (!p) {
+        return run_tail_calls(ev, slot->machine(args));
+    }
+    u32 outer = p->nativeDepth;
+    p->nativeDepth = depth;
+    double result = run_tail_calls(ev, slot->machine(args));
+    p->nativeDepth = outer;
+    return result;
+}
+
+// `ks_call` of machine code: a call to another function.
+double eval_native_call(void* ctx, u32 callee, const double* args, u32 argsCount) {
+    Evaluator* ev = ctx;
+    return ev->profiler ? call_profiled(ev, callee, args, argsCount, profiler_callee_depth(ev->profiler->nativeDepth)) : call_function(ev, callee, args, argsCount);
+}
+
+// `ks_drain` of machine code: after a direct self-call that is not in tail
+// position, make the tail call the callee handed back, so the caller goes
+// on with its result rather than with the 0 it returned.
+double eval_native_drain(void* ctx, double result) {
+    Evaluator* ev = ctx;
+    Profiler* p = ev->profiler;
+    if (!p) {
+        return run_tail_calls(ev, result);
+    }
+    // The tail call is one deeper than the code that drains it.
+    u32 outer = p->nativeDepth;
+    p->nativeDepth = profiler_callee_depth(outer);
+    result = run_tail_calls(ev, result);
+    profiler_leave(p, p->nativeDepth);
+    p->nativeDepth = outer;
+    return result;
+}
+
+// `ks_overflow` of machine code: a function that calls itself directly
+// found its frame past ev->stackLimit.
+double eval_native_overflow(void* ctx) {
+    return eval_error(ctx, "Recursion too deep");
+}
+
+// `ks_tail` of machine code: a call in tail position, left for
+// run_machine() to make once the caller has returned.
+double eval_native_tail(void* ctx, u32 callee, const double* args, u32 argsCount) {
+    Evaluator* ev = ctx;
+    if (argsCount > ev->tailArgsCapacity) {
+        ev->tailArgsCapacity = argsCount;
+        ev->tailArgs = realloc(ev->tailArgs, sizeof(double) * argsCount);
+    }
+    memcpy(ev->tailArgs, args, sizeof(double) * argsCount);
+    ev->tailArgsCount = argsCount;
+    ev->tailCallee = callee;
+    return 0;
+}
+
+// Drop the code of every function that inlined `index`, so it is lowered
+// again, with the new body, when next called. The anonymous function is
+// skipped: it is redefined by the next expression, and the AST it was
+// lowered from is not kept.
+static void invalidate_dependents(Evaluator* ev, u32 index) {
+    IrModule* m = &ev->module;
+    for (u32 f = 0; f < m->count; f++) {
+        const IrFunction* fn = m->functions[f];
+        for (u32 i = 0; f != ev->anonymous && fn->defined && i < fn->inlinedCount; i++) {
+            if (fn->inlined[i] == index) {
+                define_function(ev, f, fn->ast);
+                break;
+            }
+        }
+    }
+}
+
+// Define or evaluate a top-level item. Returns false with ev->error set on
+// failure; `result` receives the value of top-level expressions.
+bool eval_item(Evaluator* ev, const ItemAST* item, double* result) {
+    ev->error = NULL;
+    switch (item->type) {
+    case ItemDefType: {
+        const FunctionAST* def = clone_function(&ev->arena, &item->fn);
+        u32 index = ir_function(&ev->module, def->proto.name);
+        bool redefined = ev->module.functions[index]->defined;
+        define_function(ev, index, def);
+        if (redefined) {
+            invalidate_dependents(ev, index);
+        }
+        return true;
+    }
+    case ItemExternType: {
+        NativeFn native = find_builtin(item->fn.proto.name, item->fn.proto.argsCount);
+        if (!native) {
+            ev->error = "Unknown extern";
+            return false;
+        }
+        u32 index = ir_function(&ev->module, item->fn.proto.name);
+        bool redefined = ev->module.functions[index]->defined;
+        ir_declare_extern(&ev->module, index, item->fn.proto.argsCount);
+        EvalSlot* slot = get_slot(ev, index);
+        drop_code(slot);
+        slot->native = native;
+        if (redefined) {
+            invalidate_dependents(ev, index);
+        }
+        return true;
+    }
+    case ItemExprType:
+        if (ev->profiler) {
+            ev->profiler->root = item->fn.start;
+        }
+        define_function(ev, ev->anonymous, &item->fn);
+        // A quarter of the stack is kept for the frames above this one and
+        // for what the deepest call runs: builtins, compiling, printing.
+        ev->stackLimit = (const char*)__builtin_frame_address(0) - ev->stackSize / 4 * 3;
+        *result = ev->profiler ? call_profiled(ev, ev->anonymous, NULL, 0, 0) : call_function(ev, ev->anonymous, NULL, 0);
+        return !ev->error;
+    }
+    return false;
+}
+
+// Evaluate each top-level item, printing the value of expressions. An item
+// that fails is reported and the rest still run; false if any failed.
+bool eval_items(Evaluator* ev, const ItemAST* items, usize itemsCount) {
+    bool ok = true;
+    for (usize i = 0; i < itemsCount; i++) {
+        double result;
+        if (!eval_item(ev, &items[i], &result)) {
+            // Keep the error after the values printed before it.
+            fflush(stdout);
+            fprintf(stderr, "error: %s\n", ev->error);
+            ok = false;
+        } else if (items[i].type == ItemExprType) {
+            printf("%f\n", result);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "arena.h"
+#include "ir.h"
+#include "parser.h"
+#include "types.h"
+#include <stdbool.h>
+
+// Host implementation of an `extern`, called with the evaluated arguments.
+typedef double (*NativeFn)(const double* args);
+
+// How machine code from the native cache calls back into the evaluator.
+typedef double (*EvalNativeCall)(void* ctx, u32 callee, const double* args, u32 argsCount);
+typedef double (*EvalNativeDrain)(void* ctx, double result);
+typedef double (*EvalNativeOverflow)(void* ctx);
+
+typedef struct EvalOp EvalOp;
+typedef struct NativeCache NativeCache;
+typedef struct Profiler Profiler;
+
+// How the interpreter runs function `index` of the module.
+typedef struct {
+    NativeFn native; // externs
+    NativeFn machine; // definitions loaded from the native cache
+    // Definitions, compiled from the IR to a flat array of register
+    // operations (see eval.c); NULL until first called.
+    EvalOp* ops;
+    u32* args; // call arguments, as registers
+    u32 registers;
+    u32 maxCallArgs;
+} EvalSlot;
+
+// Executes the SSA IR of ir.h. Functions live in `module`; definitions
+// are lowered when first called, and lowered again after a function they
+// inlined is redefined, so their ASTs are copied into `arena`. The arena
+// the items were parsed into can be reset once they are evaluated.
+typedef struct {
+    Arena arena;
+    IrModule module;
+    EvalSlot* slots; // by function index
+    u32 slotsCapacity;
+    u32 anonymous; // function top-level expressions are lowered into
+    Profiler* profiler; // NULL unless profiling
+    NativeCache* cache; // NULL unless definitions run as machine code
+    // A tail call handed back by machine code, for the trampoline in
+    // run_tail_calls(); tailCallee is IR_NONE when there is none.
+    u32 tailCallee;
+    double* tailArgs;
+    u32 tailArgsCount;
+    u32 tailArgsCapacity;
+    // Calls fail once the stack reaches `stackLimit`, set below the frame
+    // of each top-level expression from the `stackSize` the process has.
+    usize stackSize;
+    const char* stackLimit;
+    const char* error;
+} Evaluator;
+
+u64 hash_name(const char* name);
+void evaluator_init(Evaluator* ev);
+void evaluator_free(Evaluator* ev);
+double eval_native_call(void* ctx, u32 callee, const double* args, u32 argsCount);
+double eval_native_tail(void* ctx, u32 callee, const double* args, u32 argsCount);
+double eval_native_drain(void* ctx, double result);
+double eval_native_overflow(void* ctx);
+bool eval_item(Evaluator* ev, const ItemAST* item, double* result);
+bool eval_items(Evaluator* ev, const ItemAST* items, usize itemsCount);
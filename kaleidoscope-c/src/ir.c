@@ -0,0 +1,526 @@
+#include "ir.h"
+#include "arena.h"
+#include "eval.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---- Module ----
+
+void ir_module_init(IrModule* m) {
+    *m = (IrModule) { .optimize = true };
+    m->byNameCapacity = 64;
+    m->byName = calloc(m->byNameCapacity, sizeof(IrName));
+}
+
+void ir_module_free(IrModule* m) {
+    free(m->byName);
+    free(m->functions);
+    arena_free(&m->arena);
+    *m = (IrModule) { 0 };
+}
+
+static IrName* find_name_slot(IrName* byName, u32 capacity, const char* name, u32 hash) {
+    usize i = hash & (capacity - 1);
+    while (byName[i].name && (byName[i].hash != hash || strcmp(byName[i].name, name) != 0)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &byName[i];
+}
+
+u32 ir_lookup(const IrModule* m, const char* name) {
+    const IrName* slot = find_name_slot(m->byName, m->byNameCapacity, name, hash_name(name));
+    return slot->name ? slot->index : IR_NONE;
+}
+
+// Index of the function called `name`, adding an undefined one if needed.
+// A NULL name always adds a new anonymous function.
+u32 ir_function(IrModule* m, const char* name) {
+    IrName* slot = NULL;
+    u32 hash = 0;
+    if (name) {
+        hash = hash_name(name);
+        slot = find_name_slot(m->byName, m->byNameCapacity, name, hash);
+        if (slot->name) {
+            return slot->index;
+        }
+    }
+    if (m->count == m->capacity) {
+        m->capacity = m->capacity ? m->capacity * 2 : 64;
+        m->functions = realloc(m->functions, sizeof(IrFunction*) * m->capacity);
+    }
+    IrFunction* fn = arena_alloc(&m->arena, sizeof(IrFunction));
+    *fn = (IrFunction) { .loopHeader = IR_NONE };
+    if (name) {
+        usize length = strlen(name);
+        char* copy = arena_alloc(&m->arena, length + 1);
+        memcpy(copy, name, length + 1);
+        fn->name = copy;
+    }
+    u32 index = m->count++;
+    m->functions[index] = fn;
+    if (!name) {
+        return index;
+    }
+
+    *slot = (IrName) { fn->name, index, hash };
+    if (++m->namesCount * 2 > m->byNameCapacity) {
+        u32 capacity = m->byNameCapacity * 2;
+        IrName* byName = calloc(capacity, sizeof(IrName));
+        for (u32 i = 0; i < m->byNameCapacity; i++) {
+            if (m->byName[i].name) {
+                usize j = m->byName[i].hash & (capacity - 1);
+                while (byName[j].name) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                byName[j] = m->byName[i];
+            }
+        }
+        free(m->byName);
+        m->byName = byName;
+        m->byNameCapacity = capacity;
+    }
+    return index;
+}
+
+void ir_declare_extern(IrModule* m, u32 index, u32 paramsCount) {
+    IrFunction* fn = m->functions[index];
+    fn->defined = false;
+    fn->lowered = false;
+    fn->optimized = false;
+    fn->isExtern = true;
+    fn->paramsCount = paramsCount;
+}
+
+// ---- Building ----
+
+#define GROW(m, array, count, capacity)                                                       \
+    do {                                                                                      \
+        if ((count) == (capacity)) {                                                          \
+            usize grown_ = (capacity) ? (capacity) * 2 : 8;                                   \
+            (array) = arena_realloc(&(m)->arena, (array), sizeof(*(array)) * (capacity),      \
+                sizeof(*(array)) * grown_);                                                   \
+            (capacity) = grown_;                                                              \
+        }                                                                                     \
+    } while (0)
+
+u32 ir_new_block(IrModule* m, IrFunction* fn) {
+    GROW(m, fn->blocks, fn->blocksCount, fn->blocksCapacity);
+    fn->blocks[fn->blocksCount] = (IrBlock) { .term = { .kind = IrReturn, .value = IR_NONE } };
+    return fn->blocksCount++;
+}
+
+IrValue ir_new_inst(IrModule* m, IrFunction* fn, IrInst inst) {
+    GROW(m, fn->insts, fn->instsCount, fn->instsCapacity);
+    fn->insts[fn->instsCount] = inst;
+    return fn->instsCount++;
+}
+
+void ir_append(IrModule* m, IrFunction* fn, u32 block, IrValue value) {
+    IrBlock* b = &fn->blocks[block];
+    GROW(m, b->insts, b->instsCount, b->instsCapacity);
+    b->insts[b->instsCount++] = value;
+}
+
+void ir_add_pred(IrModule* m, IrFunction* fn, u32 block, u32 pred) {
+    IrBlock* b = &fn->blocks[block];
+    GROW(m, b->preds, b->predsCount, b->predsCapacity);
+    b->preds[b->predsCount++] = pred;
+}
+
+u32 ir_push_operands(IrModule* m, IrFunction* fn, const IrValue* values, u32 count) {
+    u32 first = fn->operandsCount;
+    for (u32 i = 0; i < count; i++) {
+        GROW(m, fn->operands, fn->operandsCount, fn->operandsCapacity);
+        fn->operands[fn->operandsCount++] = values[i];
+    }
+    return first;
+}
+
+// Value operands of `inst`, which lives in `block`.
+u32 ir_operand_count(const IrFunction* fn, const IrInst* inst, u32 block) {
+    switch (inst->op) {
+    case IrAdd:
+    case IrSub:
+    case IrMul:
+    case IrLess:
+        return 2;
+    case IrCall:
+        return inst->value.call.count;
+    case IrPhi:
+        return fn->blocks[block].predsCount;
+    default:
+        return 0;
+    }
+}
+
+IrValue* ir_operands(IrFunction* fn, IrInst* inst) {
+    switch (inst->op) {
+    case IrAdd:
+    case IrSub:
+    case IrMul:
+    case IrLess:
+        return inst->value.operands;
+    case IrCall:
+        return fn->operands + inst->value.call.first;
+    case IrPhi:
+        return fn->operands + inst->value.phi;
+    default:
+        return NULL;
+    }
+}
+
+// The call `block` ends with if its result is also the function's: either
+// returned directly, or passed through blocks that only forward it in a
+// phi to a return. IR_NONE if there is none.
+IrValue ir_tail_call(const IrFunction* fn, u32 block) {
+    const IrBlock* b = &fn->blocks[block];
+    if (b->instsCount == 0 || fn->insts[b->insts[b->instsCount - 1]].op != IrCall) {
+        return IR_NONE;
+    }
+    IrValue call = b->insts[b->instsCount - 1];
+    IrValue value = call;
+    for (u32 hops = 0; hops < fn->blocksCount; hops++) {
+        if (b->term.kind == IrReturn) {
+            return b->term.value == value ? call : IR_NONE;
+        }
+        if (b->term.kind != IrJump) {
+            return IR_NONE;
+        }
+        const IrBlock* next = &fn->blocks[b->term.targets[0]];
+        if (next->instsCount != 1 || fn->insts[next->insts[0]].op != IrPhi) {
+            return IR_NONE;
+        }
+        u32 edge = 0;
+        while (&fn->blocks[next->preds[edge]] != b) {
+            edge++;
+        }
+        if (fn->operands[fn->insts[next->insts[0]].value.phi + edge] != value) {
+            return IR_NONE;
+        }
+        value = next->insts[0];
+        b = next;
+    }
+    return IR_NONE;
+}
+
+// ---- Lowering ----
+
+typedef struct {
+    IrModule* m;
+    IrFunction* fn;
+    const PrototypeAST* proto;
+    u32 block; // insertion point
+    const char* error;
+} IrBuilder;
+
+static IrValue emit_inst(IrBuilder* b, IrInst inst) {
+    IrValue value = ir_new_inst(b->m, b->fn, inst);
+    ir_append(b->m, b->fn, b->block, value);
+    return value;
+}
+
+static void emit_jump(IrBuilder* b, u32 target) {
+    b->fn->blocks[b->block].term = (IrTerm) { .kind = IrJump, .value = IR_NONE, .targets = { target } };
+    ir_add_pred(b->m, b->fn, target, b->block);
+}
+
+static IrValue lower_expr(IrBuilder* b, const ExprAST* expr) {
+    switch (expr->type) {
+    case ExprNumberType:
+        return emit_inst(b, (IrInst) { .op = IrConst, .value = { .number = expr->value.numberValue } });
+    case ExprVariableType:
+        // Parameters are the first values; the first matching name wins.
+        for (usize i = 0; i < b->proto->argsCount; i++) {
+            if (strcmp(b->proto->args[i], expr->value.variableName) == 0) {
+                return i;
+            }
+        }
+        b->error = "Unknown variable name";
+        return emit_inst(b, (IrInst) { .op = IrConst });
+    case ExprBinopType: {
+        IrValue lhs = lower_expr(b, expr->value.binop.lhs);
+        IrValue rhs = lower_expr(b, expr->value.binop.rhs);
+        IrOp op;
+        switch (expr->value.binop.op) {
+        case '+':
+            op = IrAdd;
+            break;
+        case '-':
+            op = IrSub;
+            break;
+        case '*':
+            op = IrMul;
+            break;
+        case '<':
+            op = IrLess;
+            break;
+        default:
+            b->error = "Invalid binary operator";
+            return lhs;
+        }
+        return emit_inst(b, (IrInst) { .op = op, .value = { .operands = { lhs, rhs } } });
+    }
+    case ExprCallType: {
+        usize count = expr->value.call.argsCount;
+        IrValue* args = malloc(sizeof(IrValue) * (count + 1));
+        for (usize i = 0; i < count; i++) {
+            args[i] = lower_expr(b, expr->value.call.args[i]);
+        }
+        IrInst call = { .op = IrCall };
+        call.value.call.callee = ir_function(b->m, expr->value.call.callee);
+        call.value.call.first = ir_push_operands(b->m, b->fn, args, count);
+        call.value.call.count = count;
+        free(args);
+        return emit_inst(b, call);
+    }
+    case ExprIfType: {
+        IrValue cond = lower_expr(b, expr->value.conditional.cond);
+        u32 thenBlock = ir_new_block(b->m, b->fn);
+        u32 elseBlock = ir_new_block(b->m, b->fn);
+        u32 merge = ir_new_block(b->m, b->fn);
+        b->fn->blocks[b->block].term = (IrTerm) { .kind = IrBranch, .value = cond, .targets = { thenBlock, elseBlock } };
+        ir_add_pred(b->m, b->fn, thenBlock, b->block);
+        ir_add_pred(b->m, b->fn, elseBlock, b->block);
+
+        b->block = thenBlock;
+        IrValue incoming[2];
+        incoming[0] = lower_expr(b, expr->value.conditional.then);
+        emit_jump(b, merge);
+        b->block = elseBlock;
+        incoming[1] = lower_expr(b, expr->value.conditional.otherwise);
+        emit_jump(b, merge);
+
+        b->block = merge;
+        IrInst phi = { .op = IrPhi };
+        phi.value.phi = ir_push_operands(b->m, b->fn, incoming, 2);
+        return emit_inst(b, phi);
+    }
+    }
+    b->error = "Unknown expression";
+    return emit_inst(b, (IrInst) { .op = IrConst });
+}
+
+static void measure_frame(IrFunction* fn) {
+    fn->maxPhis = 0;
+    fn->maxCallArgs = 0;
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        u32 phis = 0;
+        for (u32 i = 0; !block->dead && i < block->instsCount; i++) {
+            const IrInst* inst = &fn->insts[block->insts[i]];
+            if (inst->op == IrPhi) {
+                phis++;
+            } else if (inst->op == IrCall && inst->value.call.count > fn->maxCallArgs) {
+                fn->maxCallArgs = inst->value.call.count;
+            }
+        }
+        fn->maxPhis = phis > fn->maxPhis ? phis : fn->maxPhis;
+    }
+}
+
+// Give function `index` a new body without lowering it yet.
+void ir_set_body(IrModule* m, u32 index, const FunctionAST* ast) {
+    IrFunction* fn = m->functions[index];
+    *fn = (IrFunction) {
+        .name = fn->name,
+        .paramsCount = ast->proto.argsCount,
+        .defined = true,
+        .ast = ast,
+        .loopHeader = IR_NONE,
+    };
+}
+
+// Lower the body of function `index` from its AST, unoptimized.
+bool ir_lower(IrModule* m, u32 index, const char** error) {
+    IrFunction* slot = m->functions[index];
+    const FunctionAST* ast = slot->ast;
+    IrFunction fn = { .name = slot->name, .loopHeader = IR_NONE };
+    IrBuilder b = { .m = m, .fn = &fn, .proto = &ast->proto };
+
+    b.block = ir_new_block(m, &fn);
+    for (usize i = 0; i < ast->proto.argsCount; i++) {
+        emit_inst(&b, (IrInst) { .op = IrParam, .value = { .param = i } });
+    }
+    u32 body = ir_new_block(m, &fn);
+    emit_jump(&b, body);
+    b.block = body;
+    IrValue result = lower_expr(&b, ast->body);
+    fn.blocks[b.block].term = (IrTerm) { .kind = IrReturn, .value = result };
+    if (b.error) {
+        *error = b.error;
+        return false;
+    }
+
+    // Lowering may have added functions, so the slot is looked up again.
+    slot = m->functions[index];
+    fn.paramsCount = ast->proto.argsCount;
+    fn.defined = true;
+    fn.lowered = true;
+    fn.ast = ast;
+    *slot = fn;
+    return true;
+}
+
+// Lower and optimize function `index`, unless that already happened
+// since it was last defined.
+bool ir_materialize(IrModule* m, u32 index, const char** error) {
+    IrFunction* fn = m->functions[index];
+    if (!fn->lowered && !ir_lower(m, index, error)) {
+        return false;
+    }
+    if (!fn->optimized) {
+        fn->optimized = true;
+        if (m->optimize) {
+            ir_optimize(m, index);
+        }
+        measure_frame(fn);
+    }
+    return true;
+}
+
+bool ir_define(IrModule* m, u32 index, const FunctionAST* ast, const char** error) {
+    ir_set_body(m, index, ast);
+    return ir_materialize(m, index, error);
+}
+
+static bool lower_items(IrModule* m, const ItemAST* items, usize itemsCount, const char** error, const char** where) {
+    for (usize i = 0; i < itemsCount; i++) {
+        const FunctionAST* fn = &items[i].fn;
+        if (items[i].type == ItemExprType) {
+            *where = NULL;
+            if (!ir_define(m, ir_function(m, NULL), fn, error)) {
+                return false;
+            }
+            continue;
+        }
+        *where = fn->proto.name;
+        u32 index = ir_function(m, fn->proto.name);
+        IrFunction* slot = m->functions[index];
+        if ((slot->defined || slot->isExtern) && slot->paramsCount != fn->proto.argsCount) {
+            *error = "Conflicting number of arguments";
+            return false;
+        }
+        if (items[i].type == ItemExternType) {
+            if (!slot->defined) {
+                ir_declare_extern(m, index, fn->proto.argsCount);
+            }
+            continue;
+        }
+        if (slot->defined) {
+            *error = "Function redefined";
+            return false;
+        }
+        if (!ir_define(m, index, fn, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_calls(IrModule* m, const char** error, const char** where) {
+    for (u32 f = 0; f < m->count; f++) {
+        const IrFunction* fn = m->functions[f];
+        *where = fn->name;
+        for (u32 bi = 0; fn->defined && bi < fn->blocksCount; bi++) {
+            const IrBlock* block = &fn->blocks[bi];
+            for (u32 i = 0; !block->dead && i < block->instsCount; i++) {
+                const IrInst* inst = &fn->insts[block->insts[i]];
+                if (inst->op != IrCall) {
+                    continue;
+                }
+                const IrFunction* callee = m->functions[inst->value.call.callee];
+                if (!callee->defined && !callee->isExtern) {
+                    *error = "Unknown function referenced";
+                    return false;
+                }
+                if (callee->paramsCount != inst->value.call.count) {
+                    *error = "Incorrect # arguments passed";
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Lower a whole program for the ahead-of-time backends. Calls are bound
+// once for the whole program, so each name may be defined only once (an
+// extern may precede its definition) and every call must resolve. Each
+// top-level expression becomes an anonymous function, in order. On error,
+// `where` names the offending function, or is NULL for a top-level
+// expression.
+bool ir_lower_program(IrModule* m, const ItemAST* items, usize itemsCount, const char** error, const char** where) {
+    // Optimize once everything is lowered, so inlining sees callees
+    // defined later in the program too.
+    bool optimize = m->optimize;
+    m->optimize = false;
+    bool ok = lower_items(m, items, itemsCount, error, where) && check_calls(m, error, where);
+    m->optimize = optimize;
+    for (u32 f = 0; ok && optimize && f < m->count; f++) {
+        if (m->functions[f]->defined) {
+            ir_optimize(m, f);
+            measure_frame(m->functions[f]);
+        }
+    }
+    return ok;
+}
+
+// ---- Printing ----
+
+static const char* const irOpNames[] = { "const", "param", "add", "sub", "mul", "lt", "call", "phi" };
+
+static void print_function(FILE* out, const IrModule* m, const IrFunction* fn) {
+    fprintf(out, "%s %s(%u) {\n", fn->name ? "def" : "expr", fn->name ? fn->name : "", fn->paramsCount);
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* block = &fn->blocks[bi];
+        if (block->dead) {
+            continue;
+        }
+        fprintf(out, "b%u:", bi);
+        for (u32 p = 0; p < block->predsCount; p++) {
+            fprintf(out, p ? ", b%u" : "  ; preds b%u", block->preds[p]);
+        }
+        fputc('\n', out);
+        for (u32 i = 0; i < block->instsCount; i++) {
+            IrValue v = block->insts[i];
+            IrInst* inst = &fn->insts[v];
+            fprintf(out, "  v%u = %s", v, irOpNames[inst->op]);
+            if (inst->op == IrConst) {
+                fprintf(out, " %g", inst->value.number);
+            } else if (inst->op == IrParam) {
+                fprintf(out, " %u", inst->value.param);
+            } else if (inst->op == IrCall) {
+                fprintf(out, " %s", m->functions[inst->value.call.callee]->name);
+            }
+            u32 count = ir_operand_count(fn, inst, bi);
+            IrValue* operands = ir_operands((IrFunction*)fn, inst);
+            for (u32 o = 0; o < count; o++) {
+                fprintf(out, o ? ", v%u" : " v%u", operands[o]);
+            }
+            fputc('\n', out);
+        }
+        const IrTerm* term = &block->term;
+        switch (term->kind) {
+        case IrReturn:
+            fprintf(out, "  ret v%u\n", term->value);
+            break;
+        case IrJump:
+            fprintf(out, "  jump b%u\n", term->targets[0]);
+            break;
+        case IrBranch:
+            fprintf(out, "  br v%u, b%u, b%u\n", term->value, term->targets[0], term->targets[1]);
+            break;
+        }
+    }
+    fprintf(out, "}\n\n");
+}
+
+void ir_print(FILE* out, const IrModule* m) {
+    for (u32 i = 0; i < m->count; i++) {
+        if (m->functions[i]->defined) {
+            print_function(out, m, m->functions[i]);
+        }
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "arena.h"
+#include "parser.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// SSA intermediate representation shared by the execution backends.
+//
+// A function owns one contiguous array of instructions; a value is the
+// index of the instruction that defines it. Blocks list the instructions
+// they execute, phis first, and end in a terminator. Phi operands are
+// aligned with the block's predecessor list. Everything is allocated in
+// the module arena; passes drop instructions from block lists rather than
+// freeing them.
+
+typedef u32 IrValue;
+#define IR_NONE ((u32)-1)
+
+typedef enum {
+    IrConst,
+    IrParam,
+    IrAdd,
+    IrSub,
+    IrMul,
+    IrLess,
+    IrCall,
+    IrPhi
+} IrOp;
+
+typedef struct {
+    IrOp op;
+    union {
+        double number; // IrConst
+        u32 param; // IrParam
+        IrValue operands[2]; // IrAdd, IrSub, IrMul, IrLess
+        struct {
+            u32 callee; // function index in the module
+            u32 first; // arguments in IrFunction.operands
+            u32 count;
+        } call;
+        u32 phi; // first incoming value in IrFunction.operands
+    } value;
+} IrInst;
+
+typedef enum {
+    IrReturn, // value
+    IrJump, // targets[0]
+    IrBranch // value ? targets[0] : targets[1]
+} IrTermKind;
+
+typedef struct {
+    IrTermKind kind;
+    IrValue value;
+    u32 targets[2];
+} IrTerm;
+
+typedef struct {
+    IrValue* insts;
+    u32 instsCount;
+    u32 instsCapacity;
+    u32* preds;
+    u32 predsCount;
+    u32 predsCapacity;
+    IrTerm term;
+    bool dead;
+} IrBlock;
+
+// One slot per function name. Calls name the slot, so a slot may be
+// referenced before it is defined and redefined later.
+typedef struct {
+    const char* name; // NULL for top-level expressions
+    u32 paramsCount;
+    bool defined; // has a body
+    bool lowered; // the body has been lowered from `ast`...
+    bool optimized; // ...and optimized
+    bool isExtern;
+    const FunctionAST* ast; // source of the body, lowered on demand
+    // Body. Block 0 holds the parameters and jumps to the first real
+    // block; passes never merge it away.
+    IrInst* insts;
+    u32 instsCount;
+    u32 instsCapacity;
+    IrValue* operands;
+    u32 operandsCount;
+    u32 operandsCapacity;
+    IrBlock* blocks;
+    u32 blocksCount;
+    u32 blocksCapacity;
+    u32 loopHeader; // block added by tail-recursion elimination, or IR_NONE
+    // Frame sizing for the interpreter.
+    u32 maxPhis; // most phis at the start of any block
+    u32 maxCallArgs;
+    // Functions whose bodies were inlined into this one, transitively.
+    u32* inlined;
+    u32 inlinedCount;
+} IrFunction;
+
+typedef struct {
+    const char* name; // NULL for an empty entry
+    u32 index;
+    u32 hash;
+} IrName;
+
+typedef struct {
+    Arena arena;
+    IrFunction** functions;
+    u32 count;
+    u32 capacity;
+    IrName* byName; // open addressing, keyed by name
+    u32 byNameCapacity;
+    u32 namesCount;
+    bool optimize;
+} IrModule;
+
+void ir_module_init(IrModule* m);
+void ir_module_free(IrModule* m);
+u32 ir_function(IrModule* m, const char* name);
+u32 ir_lookup(const IrModule* m, const char* name);
+void ir_declare_extern(IrModule* m, u32 index, u32 paramsCount);
+void ir_set_body(IrModule* m, u32 index, const FunctionAST* ast);
+bool ir_lower(IrModule* m, u32 index, const char** error);
+bool ir_materialize(IrModule* m, u32 index, const char** error);
+bool ir_define(IrModule* m, u32 index, const FunctionAST* ast, const char** error);
+bool ir_lower_program(IrModule* m, const ItemAST* items, usize itemsCount, const char** error, const char** where);
+void ir_print(FILE* out, const IrModule* m);
+
+// Helpers shared with the passes and backends.
+u32 ir_new_block(IrModule* m, IrFunction* fn);
+IrValue ir_new_inst(IrModule* m, IrFunction* fn, IrInst inst);
+void ir_append(IrModule* m, IrFunction* fn, u32 block, IrValue value);
+void ir_add_pred(IrModule* m, IrFunction* fn, u32 block, u32 pred);
+u32 ir_push_operands(IrModule* m, IrFunction* fn, const IrValue* values, u32 count);
+u32 ir_operand_count(const IrFunction* fn, const IrInst* inst, u32 block);
+IrValue* ir_operands(IrFunction* fn, IrInst* inst);
+IrValue ir_tail_call(const IrFunction* fn, u32 block);
+
+// ---- Passes (passes.c) ----
+
+typedef bool (*IrPassFn)(IrModule* m, u32 index);
+
+typedef struct {
+    const char* name;
+    IrPassFn run;
+} IrPass;
+
+void ir_optimize(IrModule* m, u32 index);
@@ -15,6 +15,12 @@ const char* token_to_string(Arena* arena, Token token) {
         return "Def";
     case TokExtern:
         return "Extern";
+    case TokIf:
+        return "If";
+    case TokThen:
+        return "Then";
+    case TokElse:
+        return "Else";
     case TokIdentifier:
         return token.value.identifier;
     case TokNumber: {
@@ -42,6 +48,9 @@ bool token_equals(Token token1, Token token2) {
     case TokEof:
     case TokDef:
     case TokExtern:
+    case TokIf:
+    case TokThen:
+    case TokElse:
         return true;
     case TokIdentifier:
         return strcmp(token1.value.identifier, token2.value.identifier) == 0;
@@ -68,6 +77,25 @@ static int skip_comment(const char* input, usize idx) {
     return idx;
 }
 
+static Token keyword_or_id(char* identifierStr) {
+    Token token;
+    if (strcmp(identifierStr, "def") == 0) {
+        token.kind = TokDef;
+    } else if (strcmp(identifierStr, "extern") == 0) {
+        token.kind = TokExtern;
+    } else if (strcmp(identifierStr, "if") == 0) {
+        token.kind = TokIf;
+    } else if (strcmp(identifierStr, "then") == 0) {
+        token.kind = TokThen;
+    } else if (strcmp(identifierStr, "else") == 0) {
+        token.kind = TokElse;
+    } else {
+        token.kind = TokIdentifier;
+        token.value.identifier = identifierStr;
+    }
+    return token;
+}
+
 static int lex_keyword_or_id(Arena* arena, const char* input, usize idx, Token tokens[], int tokenCount) {
 
     const int start = idx;
@@ -78,14 +106,8 @@ static int lex_keyword_or_id(Arena* arena, const char* input, usize idx, Token t
     char* identifierStr = arena_alloc(arena, length + 1);
     strncpy(identifierStr, input + start, length);
     identifierStr[length] = '\0';
-    if (strcmp(identifierStr, "def") == 0) {
-        tokens[tokenCount].kind = TokDef;
-    } else if (strcmp(identifierStr, "extern") == 0) {
-        tokens[tokenCount].kind = TokExtern;
-    } else {
-        tokens[tokenCount].kind = TokIdentifier;
-        tokens[tokenCount].value.identifier = identifierStr;
-    }
+    tokens[tokenCount] = keyword_or_id(identifierStr);
+    tokens[tokenCount].start = start;
 
     return idx;
 }
@@ -108,7 +130,7 @@ static int lex_number(const char* input, usize idx, Token tokens[], int tokenCou
 
 Token* lex(Arena* arena, const char* input) {
     usize idx = 0;
-    Token* tokens = arena_alloc(arena, sizeof(Token) * strlen(input));
+    Token* tokens = arena_alloc(arena, sizeof(Token) * (strlen(input) + 1));
     int tokenCount = 0;
 
     while (input[idx]) {
@@ -120,12 +142,14 @@ Token* lex(Arena* arena, const char* input) {
             idx = lex_keyword_or_id(arena, input, idx, tokens, tokenCount);
             tokenCount++;
         } else if (isdigit(input[idx]) || input[idx] == '.') {
+            tokens[tokenCount].start = idx;
             idx = lex_number(input, idx, tokens, tokenCount);
             tokenCount++;
         } else if (input[idx] == '#') {
             idx = skip_comment(input, idx);
         } else {
             tokens[tokenCount].kind = TokOther;
+            tokens[tokenCount].start = idx;
             tokens[tokenCount].value.other = input[idx];
             tokenCount++;
             idx++;
@@ -133,5 +157,167 @@ Token* lex(Arena* arena, const char* input) {
     }
 
     tokens[tokenCount].kind = TokEof;
+    tokens[tokenCount].start = idx;
+    return tokens;
+}
+
+// ---- Streaming ----
+
+void lexer_init(Lexer* l, LexerReadFn read, void* ctx) {
+    l->read = read;
+    l->ctx = ctx;
+    l->pos = 0;
+    l->len = 0;
+    l->base = 0;
+    l->eof = false;
+    l->scratch = NULL;
+    l->scratchCap = 0;
+    l->hasPending = false;
+}
+
+void lexer_free(Lexer* l) {
+    free(l->scratch);
+    l->scratch = NULL;
+    l->scratchCap = 0;
+}
+
+// Current character, refilling the chunk as needed; -1 at end of input.
+static int lexer_peek(Lexer* l) {
+    if (l->pos == l->len) {
+        if (l->eof) {
+            return -1;
+        }
+        l->base += l->len;
+        l->pos = 0;
+        l->len = l->read(l->ctx, l->chunk, LEXER_CHUNK_SIZE);
+        if (l->len == 0) {
+            l->eof = true;
+            return -1;
+        }
+    }
+    return (unsigned char)l->chunk[l->pos];
+}
+
+static void scratch_push(Lexer* l, usize* length, char c) {
+    if (*length + 1 >= l->scratchCap) {
+        l->scratchCap = l->scratchCap ? l->scratchCap * 2 : 64;
+        l->scratch = realloc(l->scratch, l->scratchCap);
+    }
+    l->scratch[(*length)++] = c;
+    l->scratch[*length] = '\0';
+}
+
+Token lexer_next(Lexer* l, Arena* arena) {
+    Token token;
+    int c;
+    while (true) {
+        c = lexer_peek(l);
+        if (c < 0) {
+            token.kind = TokEof;
+            token.start = l->base + l->pos;
+            return token;
+        }
+        if (isspace(c)) {
+            l->pos++;
+        } else if (c == '#') {
+            while ((c = lexer_peek(l)) >= 0 && c != '\n' && c != '\r') {
+                l->pos++;
+            }
+        } else {
+            break;
+        }
+    }
+
+    token.start = l->base + l->pos;
+    usize length = 0;
+    if (isalpha(c)) {
+        while ((c = lexer_peek(l)) >= 0 && isalnum(c)) {
+            scratch_push(l, &length, c);
+            l->pos++;
+        }
+        char* identifierStr = arena_alloc(arena, length + 1);
+        memcpy(identifierStr, l->scratch, length + 1);
+        Token keyword = keyword_or_id(identifierStr);
+        keyword.start = token.start;
+        return keyword;
+    }
+    if (isdigit(c) || c == '.') {
+        while ((c = lexer_peek(l)) >= 0 && (isdigit(c) || c == '.')) {
+            scratch_push(l, &length, c);
+            l->pos++;
+        }
+        token.kind = TokNumber;
+        token.value.number = atof(l->scratch);
+        return token;
+    }
+    token.kind = TokOther;
+    token.value.other = c;
+    l->pos++;
+    return token;
+}
+
+// Pull up to `cap` tokens; returns fewer only at end of input.
+usize lexer_next_batch(Lexer* l, Arena* arena, Token* out, usize cap) {
+    usize count = 0;
+    while (count < cap) {
+        out[count] = lexer_next(l, arena);
+        if (out[count].kind == TokEof) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+// Pull the tokens of the next group of top-level items into an
+// Eof-terminated array, ready for parse_program(). A group ends at a `;`
+// outside parentheses or before the next `def`/`extern`. Returns NULL once
+// the input is exhausted.
+Token* lexer_next_item(Lexer* l, Arena* arena, usize* count) {
+    usize capacity = 64;
+    usize length = 0;
+    usize depth = 0;
+    Token* tokens = arena_alloc(arena, sizeof(Token) * capacity);
+    while (true) {
+        Token token;
+        if (l->hasPending) {
+            token = l->pending;
+            l->hasPending = false;
+        } else {
+            token = lexer_next(l, arena);
+        }
+        if (token.kind == TokEof) {
+            if (length == 0) {
+                return NULL;
+            }
+            tokens[length].kind = TokEof;
+            tokens[length].start = token.start;
+            break;
+        }
+        if ((token.kind == TokDef || token.kind == TokExtern) && length > 0) {
+            l->pending = token;
+            l->hasPending = true;
+            tokens[length].kind = TokEof;
+            tokens[length].start = token.start;
+            break;
+        }
+        if (length + 1 == capacity) {
+            tokens = arena_realloc(arena, tokens, sizeof(Token) * capacity, sizeof(Token) * capacity * 2);
+            capacity *= 2;
+        }
+        tokens[length++] = token;
+        if (token.kind == TokOther) {
+            if (token.value.other == '(') {
+                depth++;
+            } else if (token.value.other == ')' && depth > 0) {
+                depth--;
+            } else if (token.value.other == ';' && depth == 0) {
+                tokens[length].kind = TokEof;
+                tokens[length].start = token.start + 1;
+                break;
+            }
+        }
+    }
+    *count = length;
     return tokens;
 }
@@ -1,12 +1,16 @@
 #pragma once
 
 #include "arena.h"
+#include "types.h"
 #include <stdbool.h>
 
 typedef enum {
     TokEof,
     TokDef,
     TokExtern,
+    TokIf,
+    TokThen,
+    TokElse,
     TokIdentifier,
     TokNumber,
     TokOther
@@ -15,6 +19,7 @@ typedef enum {
 typedef struct
 {
     TokenKind kind;
+    usize start; // byte offset in the input
     union {
         char* identifier;
         double number;
@@ -25,3 +30,34 @@ typedef struct
 extern Token* lex(Arena* arena, const char* input);
 const char* token_to_string(Arena* arena, Token token);
 bool token_equals(Token token1, Token token2);
+
+// ---- Streaming ----
+
+#define LEXER_CHUNK_SIZE (64 * 1024)
+
+// Fills `buf` with up to `cap` bytes of input; returns 0 at end of input.
+typedef usize (*LexerReadFn)(void* ctx, char* buf, usize cap);
+
+// Pull-based lexer over chunked input. Memory use is one chunk plus the
+// longest token, independent of the input size.
+typedef struct {
+    LexerReadFn read;
+    void* ctx;
+    char chunk[LEXER_CHUNK_SIZE];
+    usize pos;
+    usize len;
+    usize base; // input offset of chunk[0]
+    bool eof;
+    // Text of a token that may straddle chunk boundaries.
+    char* scratch;
+    usize scratchCap;
+    // Token read ahead by lexer_next_item().
+    Token pending;
+    bool hasPending;
+} Lexer;
+
+void lexer_init(Lexer* l, LexerReadFn read, void* ctx);
+void lexer_free(Lexer* l);
+Token lexer_next(Lexer* l, Arena* arena);
+usize lexer_next_batch(Lexer* l, Arena* arena, Token* out, usize cap);
+Token* lexer_next_item(Lexer* l, Arena* arena, usize* count);
@@ -0,0 +1,64 @@
+#include "lines.h"
+#include "arena.h"
+#include "types.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Count the line starts after each '\n' in input[0, length), storing them
+// in `starts` unless it is NULL. Compares 16 bytes at a time where SSE2 is
+// available; memchr() handles the tail.
+static usize scan_newlines(const char* input, usize length, usize* starts) {
+    usize count = 0;
+    usize pos = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; pos + 16 <= length; pos += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(input + pos));
+        u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        if (!starts) {
+            count += __builtin_popcount(mask);
+            continue;
+        }
+        while (mask) {
+            starts[count++] = pos + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (const char* nl = memchr(input + pos, '\n', length - pos); nl;
+         nl = memchr(nl + 1, '\n', length - (nl + 1 - input))) {
+        if (starts) {
+            starts[count] = nl - input + 1;
+        }
+        count++;
+    }
+    return count;
+}
+
+// Two passes, counting then filling, so the index is allocated once at its
+// exact size.
+void line_index_build(LineIndex* index, Arena* arena, const char* input, usize length) {
+    usize count = scan_newlines(input, length, NULL) + 1;
+    index->starts = arena_alloc(arena, sizeof(usize) * count);
+    index->starts[0] = 0;
+    scan_newlines(input, length, index->starts + 1);
+    index->count = count;
+}
+
+void line_index_locate(const LineIndex* index, usize offset, usize* line, usize* column) {
+    // Last line start <= offset.
+    usize lo = 0;
+    usize hi = index->count;
+    while (hi - lo > 1) {
+        usize mid = lo + (hi - lo) / 2;
+        if (index->starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    *line = lo + 1;
+    *column = offset - index->starts[lo] + 1;
+}
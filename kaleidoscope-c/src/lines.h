@@ -0,0 +1,14 @@
+#pragma once
+
+#include "arena.h"
+#include "types.h"
+
+// Sorted byte offsets of every line start in an input, built on demand so
+// the lexer never tracks positions itself. Line and column are 1-based.
+typedef struct {
+    usize* starts;
+    usize count;
+} LineIndex;
+
+void line_index_build(LineIndex* index, Arena* arena, const char* input, usize length);
+void line_index_locate(const LineIndex* index, usize offset, usize* line, usize* column);
@@ -0,0 +1,428 @@
+#include "loader.h"
+#include "types.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// ---- io_uring ----
+
+// The rings of an io_uring, set up with the raw syscalls so that no
+// liburing is needed. Only the loader thread touches them.
+struct Uring {
+    int fd;
+    u32* sqHead;
+    u32* sqTail;
+    u32 sqMask;
+    u32* sqArray;
+    struct io_uring_sqe* sqes;
+    u32 sqEntries;
+    u32 sqLocalTail; // SQEs written up to here, published on submit
+    u32 toSubmit;
+    u32* cqHead;
+    u32* cqTail;
+    u32 cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRing;
+    usize sqRingSize;
+    void* cqRing;
+    usize cqRingSize;
+    usize sqesSize;
+};
+
+static void uring_free(Uring* r) {
+    if (r->sqes) {
+        munmap(r->sqes, r->sqesSize);
+    }
+    if (r->cqRing && r->cqRing != r->sqRing) {
+        munmap(r->cqRing, r->cqRingSize);
+    }
+    if (r->sqRing) {
+        munmap(r->sqRing, r->sqRingSize);
+    }
+    close(r->fd);
+}
+
+// False where the kernel lacks io_uring or it is disabled.
+static bool uring_init(Uring* r, u32 entries) {
+    struct io_uring_params p = { 0 };
+    *r = (Uring) { 0 };
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return false;
+    }
+    r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(u32);
+    r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cqRingSize > r->sqRingSize) {
+        r->sqRingSize = r->cqRingSize;
+    }
+    r->sqRing = mmap(NULL, r->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sqRing == MAP_FAILED) {
+        r->sqRing = NULL;
+        uring_free(r);
+        return false;
+    }
+    r->cqRing = single ? r->sqRing
+                       : mmap(NULL, r->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->cqRing == MAP_FAILED || r->sqes == MAP_FAILED) {
+        r->cqRing = r->cqRing == MAP_FAILED ? NULL : r->cqRing;
+        r->sqes = r->sqes == MAP_FAILED ? NULL : r->sqes;
+        uring_free(r);
+        return false;
+    }
+    char* sq = r->sqRing;
+    r->sqHead = (u32*)(sq + p.sq_off.head);
+    r->sqTail = (u32*)(sq + p.sq_off.tail);
+    r->sqMask = *(u32*)(sq + p.sq_off.ring_mask);
+    r->sqArray = (u32*)(sq + p.sq_off.array);
+    r->sqEntries = p.sq_entries;
+    r->sqLocalTail = *r->sqTail;
+    char* cq = r->cqRing;
+    r->cqHead = (u32*)(cq + p.cq_off.head);
+    r->cqTail = (u32*)(cq + p.cq_off.tail);
+    r->cqMask = *(u32*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+// Whether the kernel implements every one of `opcodes`. Kernels before
+// 5.6 have neither the probe nor openat and statx.
+static bool uring_supports(Uring* r, const u8* opcodes, u32 count) {
+    usize size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    bool supported = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    for (u32 i = 0; i < count && supported; i++) {
+        supported = opcodes[i] < probe->ops_len && probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED;
+    }
+    free(probe);
+    return supported;
+}
+
+// Publish the SQEs written so far and, if `wait`, block until at least one
+// completion is posted. Returns 0, or the error of io_uring_enter() with
+// the SQEs it did not take left in the ring.
+static int uring_submit(Uring* r, bool wait) {
+    __atomic_store_n(r->sqTail, r->sqLocalTail, __ATOMIC_RELEASE);
+    while (r->toSubmit > 0 || wait) {
+        long n = syscall(__NR_io_uring_enter, r->fd, r->toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        r->toSubmit -= n;
+        wait = false;
+    }
+    return 0;
+}
+
+// Take back the SQEs the kernel has not consumed, storing their user data
+// in `userData`, which has room for the whole ring. Returns their number.
+static u32 uring_unsubmit(Uring* r, u64* userData) {
+    u32 head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+    u32 count = 0;
+    for (u32 i = head; i != r->sqLocalTail; i++) {
+        userData[count++] = r->sqes[r->sqArray[i & r->sqMask]].user_data;
+    }
+    r->sqLocalTail = head;
+    r->toSubmit = 0;
+    __atomic_store_n(r->sqTail, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+static bool uring_full(const Uring* r) {
+    return r->sqLocalTail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == r->sqEntries;
+}
+
+// A zeroed SQE, submitted with the next uring_submit(). The ring must not
+// be full.
+static struct io_uring_sqe* uring_sqe(Uring* r, u8 opcode, u64 userData) {
+    u32 index = r->sqLocalTail & r->sqMask;
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = userData;
+    r->sqArray[index] = index;
+    r->sqLocalTail++;
+    r->toSubmit++;
+    return sqe;
+}
+
+// ---- Loader ----
+
+typedef enum {
+    LoadOpen,
+    LoadStatx,
+    LoadRead,
+    LoadClose
+} LoadOp;
+
+struct LoadSlot {
+    char* buffer; // the contents; reused by the slot's next file if it fits
+    usize capacity;
+    usize index;
+    int fd;
+    int error;
+    u32 pending; // of openat and statx
+    struct statx stx;
+    char* code;
+    usize size;
+    usize length; // read so far
+};
+
+static u64 op_data(u32 slot, LoadOp op) {
+    return (u64)slot << 2 | op;
+}
+
+static void complete(Loader* l, const struct io_uring_cqe* cqe, u32* inflight);
+
+// Submit the operations queued so far. Should io_uring_enter() fail, the
+// ones it did not take complete with its error, so that their files are
+// delivered as unreadable rather than never.
+static void loader_submit(Loader* l, bool wait, u32* inflight) {
+    int error = uring_submit(l->ring, wait);
+    if (!error) {
+        return;
+    }
+    u64* userData = malloc(sizeof(u64) * l->ring->sqEntries);
+    u32 count = uring_unsubmit(l->ring, userData);
+    for (u32 i = 0; i < count; i++) {
+        complete(l, &(struct io_uring_cqe) { .user_data = userData[i], .res = -error }, inflight);
+    }
+    free(userData);
+}
+
+// Queue an operation, submitting the ones before it if the ring is full.
+static struct io_uring_sqe* loader_sqe(Loader* l, u8 opcode, u64 userData, u32* inflight) {
+    if (uring_full(l->ring)) {
+        loader_submit(l, false, inflight);
+    }
+    (*inflight)++;
+    return uring_sqe(l->ring, opcode, userData);
+}
+
+static void deliver(Loader* l, u32 slot) {
+    pthread_mutex_lock(&l->lock);
+    l->ready[(l->readyHead + l->readyCount++) % l->window] = slot;
+    pthread_cond_signal(&l->readyCond);
+    pthread_mutex_unlock(&l->lock);
+}
+
+// Close the slot's file without waiting for it and hand the slot over.
+static void finish(Loader* l, u32 slot, u32* inflight) {
+    LoadSlot* s = &l->slots[slot];
+    if (s->fd >= 0) {
+        struct io_uring_sqe* sqe = loader_sqe(l, IORING_OP_CLOSE, op_data(slot, LoadClose), inflight);
+        sqe->fd = s->fd;
+        s->fd = -1;
+    }
+    if (s->error) {
+        s->code = NULL;
+    } else {
+        s->code[s->length] = '\0';
+    }
+    deliver(l, slot);
+}
+
+static void submit_read(Loader* l, u32 slot, u32* inflight) {
+    LoadSlot* s = &l->slots[slot];
+    struct io_uring_sqe* sqe = loader_sqe(l, IORING_OP_READ, op_data(slot, LoadRead), inflight);
+    sqe->fd = s->fd;
+    sqe->addr = (u64)(uptr)(s->code + s->length);
+    sqe->len = s->size - s->length;
+    sqe->off = s->length;
+}
+
+// Open and stat file `index` concurrently into `slot`.
+static void start_file(Loader* l, u32 slot, usize index, u32* inflight) {
+    LoadSlot* s = &l->slots[slot];
+    s->index = index;
+    s->fd = -1;
+    s->error = 0;
+    s->pending = 2;
+    s->length = 0;
+    struct io_uring_sqe* sqe = loader_sqe(l, IORING_OP_OPENAT, op_data(slot, LoadOpen), inflight);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (u64)(uptr)l->paths[index];
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe = loader_sqe(l, IORING_OP_STATX, op_data(slot, LoadStatx), inflight);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (u64)(uptr)l->paths[index];
+    sqe->len = STATX_SIZE;
+    sqe->off = (u64)(uptr)&s->stx;
+}
+
+static void complete(Loader* l, const struct io_uring_cqe* cqe, u32* inflight) {
+    u32 slot = cqe->user_data >> 2;
+    LoadSlot* s = &l->slots[slot];
+    (*inflight)--;
+    switch ((LoadOp)(cqe->user_data & 3)) {
+    case LoadOpen:
+    case LoadStatx:
+        if (cqe->res < 0) {
+            s->error = -cqe->res;
+        } else if ((cqe->user_data & 3) == LoadOpen) {
+            s->fd = cqe->res;
+        }
+        if (--s->pending > 0) {
+            return;
+        }
+        if (s->error) {
+            finish(l, slot, inflight);
+            return;
+        }
+        s->size = s->stx.stx_size;
+        if (s->size + 1 > s->capacity) {
+            // Grown geometrically, so files listed smallest first do not
+            // each fault in a fresh buffer.
+            free(s->buffer);
+            s->capacity = s->size + 1 > s->capacity * 2 ? s->size + 1 : s->capacity * 2;
+            s->buffer = malloc(s->capacity);
+        }
+        s->code = s->buffer;
+        if (s->size == 0) {
+            finish(l, slot, inflight);
+        } else {
+            submit_read(l, slot, inflight);
+        }
+        return;
+    case LoadRead:
+        if (cqe->res < 0) {
+            s->error = -cqe->res;
+        } else {
+            s->length += cqe->res;
+        }
+        // A short read before the end is continued; zero means the file
+        // shrank since it was stat'ed.
+        if (!s->error && cqe->res > 0 && s->length < s->size) {
+            submit_read(l, slot, inflight);
+        } else {
+            finish(l, slot, inflight);
+        }
+        return;
+    case LoadClose:
+        return;
+    }
+}
+
+static void* loader_main(void* arg) {
+    Loader* l = arg;
+    u32* idle = malloc(sizeof(u32) * l->window);
+    u32 idleCount = l->window;
+    for (u32 i = 0; i < l->window; i++) {
+        idle[i] = l->window - 1 - i;
+    }
+    usize next = 0;
+    u32 inflight = 0;
+    Uring* r = l->ring;
+    while (next < l->pathsCount || inflight > 0) {
+        pthread_mutex_lock(&l->lock);
+        // Every slot is waiting to be compiled: wait for one back.
+        while (idleCount + l->releasedCount == 0 && inflight == 0) {
+            pthread_cond_wait(&l->releasedCond, &l->lock);
+        }
+        memcpy(idle + idleCount, l->released, sizeof(u32) * l->releasedCount);
+        idleCount += l->releasedCount;
+        l->releasedCount = 0;
+        pthread_mutex_unlock(&l->lock);
+
+        while (idleCount > 0 && next < l->pathsCount) {
+            start_file(l, idle[--idleCount], next++, &inflight);
+        }
+        loader_submit(l, true, &inflight);
+        u32 head = *r->cqHead;
+        u32 tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            complete(l, &r->cqes[head & r->cqMask], &inflight);
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+    free(idle);
+    pthread_mutex_lock(&l->lock);
+    l->done = true;
+    pthread_cond_broadcast(&l->readyCond);
+    pthread_mutex_unlock(&l->lock);
+    return NULL;
+}
+
+// Start reading `paths` with up to `window` files in memory at once.
+// Returns false, with nothing started, if io_uring is unavailable.
+bool loader_start(Loader* l, const char* const* paths, usize pathsCount, u32 window) {
+    *l = (Loader) { .paths = paths, .pathsCount = pathsCount, .window = window };
+    l->ring = malloc(sizeof(Uring));
+    // A slot has at most three operations in flight: its openat and
+    // statx, or its read, plus the close of the file it held before. The
+    // completion ring is twice the size of the submission ring.
+    static const u8 opcodes[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+    if (!uring_init(l->ring, window * 2)) {
+        free(l->ring);
+        return false;
+    }
+    if (!uring_supports(l->ring, opcodes, sizeof(opcodes) / sizeof(opcodes[0]))) {
+        uring_free(l->ring);
+        free(l->ring);
+        return false;
+    }
+    l->slots = calloc(window, sizeof(LoadSlot));
+    l->ready = malloc(sizeof(u32) * window);
+    l->released = malloc(sizeof(u32) * window);
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->readyCond, NULL);
+    pthread_cond_init(&l->releasedCond, NULL);
+    pthread_create(&l->thread, NULL, loader_main, l);
+    return true;
+}
+
+// Wait for the next file to be read, in completion order. False once every
+// file has been returned.
+bool loader_next(Loader* l, LoadedFile* file) {
+    pthread_mutex_lock(&l->lock);
+    while (l->readyCount == 0 && !l->done) {
+        pthread_cond_wait(&l->readyCond, &l->lock);
+    }
+    if (l->readyCount == 0) {
+        pthread_mutex_unlock(&l->lock);
+        return false;
+    }
+    u32 slot = l->ready[l->readyHead];
+    l->readyHead = (l->readyHead + 1) % l->window;
+    l->readyCount--;
+    pthread_mutex_unlock(&l->lock);
+
+    const LoadSlot* s = &l->slots[slot];
+    *file = (LoadedFile) { .index = s->index, .code = s->code, .size = s->length, .error = s->error, .slot = slot };
+    return true;
+}
+
+// Hand a file's buffer back for reuse; its contents become invalid.
+void loader_release(Loader* l, const LoadedFile* file) {
+    pthread_mutex_lock(&l->lock);
+    l->released[l->releasedCount++] = file->slot;
+    pthread_cond_signal(&l->releasedCond);
+    pthread_mutex_unlock(&l->lock);
+}
+
+void loader_stop(Loader* l) {
+    pthread_join(l->thread, NULL);
+    uring_free(l->ring);
+    free(l->ring);
+    for (u32 i = 0; i < l->window; i++) {
+        free(l->slots[i].buffer);
+    }
+    free(l->slots);
+    free(l->ready);
+    free(l->released);
+    pthread_mutex_destroy(&l->lock);
+    pthread_cond_destroy(&l->readyCond);
+    pthread_cond_destroy(&l->releasedCond);
+}
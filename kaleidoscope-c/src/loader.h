@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+// A file the loader has read, or failed to.
+typedef struct {
+    usize index; // into the path list
+    const char* code; // NUL-terminated; NULL on failure
+    usize size;
+    int error; // errno on failure
+    u32 slot;
+} LoadedFile;
+
+typedef struct LoadSlot LoadSlot;
+typedef struct Uring Uring;
+
+// Reads a list of files ahead of the threads that compile them. One thread
+// drives an io_uring: it submits openat, statx and read for up to `window`
+// files at once, reads each straight into the buffer of a slot, and queues
+// the slot for the compiling threads as soon as its read completes. Slots
+// are reused once released, which bounds the memory held.
+typedef struct {
+    const char* const* paths;
+    usize pathsCount;
+    Uring* ring;
+    LoadSlot* slots;
+    u32 window;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    // Guarded by `lock`.
+    pthread_cond_t readyCond;
+    pthread_cond_t releasedCond;
+    u32* ready; // slots with a result, oldest first; a ring of `window`
+    u32 readyHead;
+    u32 readyCount;
+    u32* released; // slots handed back, not yet reused
+    u32 releasedCount;
+    bool done; // every file has been queued
+} Loader;
+
+bool loader_start(Loader* l, const char* const* paths, usize pathsCount, u32 window);
+bool loader_next(Loader* l, LoadedFile* file);
+void loader_release(Loader* l, const LoadedFile* file);
+void loader_stop(Loader* l);
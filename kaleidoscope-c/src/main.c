@@ -1,9 +1,24 @@
 #define ARENA_IMPLEMENTATION
 #include "arena.h"
+#include "carena.c"
 #include "lexer.c"
+#include "lines.c"
 #include "parser.c"
+#include "ir.c"
+#include "passes.c"
+#include "eval.c"
+#include "profile.c"
+#include "stats.c"
+#include "writer.c"
+#include "repl.c"
+#include "loader.c"
+#include "batch.c"
+#include "cgen.c"
+#include "cache.c"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const char* read_contents_to_string(Arena* arena, const char* filename) {
     // Open the file for reading
@@ -36,26 +51,291 @@ static const char* read_contents_to_string(Arena* arena, const char* filename) {
     return code;
 }
 
+static void print_tokens(Writer* out, Token* tokens) {
+    for (int i = 0; tokens[i].kind != TokEof; i++) {
+        writer_token(out, tokens[i]);
+        writer_char(out, ' ');
+    }
+}
+
+// Lex and parse the input one top-level item at a time as it is read, so
+// memory stays bounded and parsing overlaps with I/O.
+static int run_stream(const char* filename) {
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening file.\n");
+        return 1;
+    }
+
+    // Items are handled as soon as they arrive, even from a pipe.
+    static Lexer lexer;
+    lexer_init(&lexer, read_fd_chunk, &fd);
+    Arena arena = { 0 };
+    Writer out;
+    writer_init(&out, STDOUT_FILENO);
+    Token* tokens;
+    usize tokensCount;
+    int status = 0;
+    while ((tokens = lexer_next_item(&lexer, &arena, &tokensCount))) {
+        usize itemsCount;
+        Diagnostics diags = { .recover = true };
+        parse_program(&arena, tokens, &itemsCount, &diags);
+        if (diags.count > 0) {
+            diagnostics_print(stderr, filename, &diags);
+            status = 1;
+        }
+        print_tokens(&out, tokens);
+        arena_reset(&arena);
+    }
+    writer_char(&out, '\n');
+
+    writer_free(&out);
+    arena_free(&arena);
+    lexer_free(&lexer);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    return status;
+}
+
+// --emit-c writes the generated C to `output` (default stdout); --emit-exe
+// compiles it through a temporary file into `output` (default a.out).
+static int emit_program(const ItemAST* items, usize itemsCount, bool exe, const char* output, bool optimize) {
+    char cPath[] = "/tmp/kaleidoscope-XXXXXX.c";
+    int fd = STDOUT_FILENO;
+    if (exe) {
+        fd = mkstemps(cPath, 2);
+    } else if (output) {
+        fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+        perror(exe ? cPath : output);
+        return 1;
+    }
+
+    Writer out;
+    writer_init(&out, fd);
+    Cgen cg;
+    bool ok = cgen_program(&cg, &out, items, itemsCount, optimize);
+    writer_free(&out);
+    if (!ok) {
+        fprintf(stderr, "error: %s in %s\n", cg.error, cg.errorFunction ? cg.errorFunction : "top-level expression");
+    }
+    cgen_free(&cg);
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+
+    int status = ok ? 0 : 1;
+    if (exe) {
+        if (ok) {
+            status = cgen_build_executable(cPath, output ? output : "a.out");
+        }
+        unlink(cPath);
+    }
+    return status;
+}
+
+// --dump-ir prints the (optimized, unless -O0) IR the backends consume.
+static int dump_ir(const ItemAST* items, usize itemsCount, bool optimize) {
+    IrModule m;
+    ir_module_init(&m);
+    m.optimize = optimize;
+    const char* error = NULL;
+    const char* where = NULL;
+    bool ok = ir_lower_program(&m, items, itemsCount, &error, &where);
+    if (ok) {
+        ir_print(stdout, &m);
+    } else {
+        fprintf(stderr, "error: %s in %s\n", error, where ? where : "top-level expression");
+    }
+    ir_module_free(&m);
+    return ok ? 0 : 1;
+}
+
+// --profile writes the samples taken while evaluating as collapsed stacks.
+static bool write_profile(const char* path, const Profiler* p, const Evaluator* ev, Arena* arena, const char* code, const char* filename) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return false;
+    }
+    LineIndex lines;
+    line_index_build(&lines, arena, code, strlen(code));
+    profiler_write(out, p, ev, filename, &lines);
+    fclose(out);
+    fprintf(stderr, "profile: %llu samples at %u Hz, %llu dropped, written to %s\n", (unsigned long long)p->samples, p->hz,
+        (unsigned long long)p->dropped, path);
+    return true;
+}
+
+// The way out of a run once it has an arena, whether it succeeded or not:
+// print `--stats`, counting the arena, and free it.
+static int finish_run(Stats* stats, Arena* arena, int status) {
+    stats_count_arena(stats, arena);
+    if (stats->enabled) {
+        fflush(stdout);
+        stats_print_json(stderr, stats);
+    }
+    arena_free(arena);
+    return status;
+}
+
 int main(int argc, char** argv) {
-    if (argc < 2) {
+    bool evalMode = false;
+    bool checkMode = false;
+    bool emitC = false;
+    bool emitExe = false;
+    bool dumpIr = false;
+    bool optimize = true;
+    const char* output = NULL;
+    bool streamMode = false;
+    const char* profilePath = NULL;
+    const char* cacheDir = NULL;
+    u32 profileHz = PROFILE_DEFAULT_HZ;
+    usize parseThreads = 1;
+    Stats stats = { 0 };
+    const char* filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repl") == 0) {
+            return run_repl(STDIN_FILENO);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            return run_batch(argc - i - 1, argv + i + 1);
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            streamMode = true;
+        } else if (strcmp(argv[i], "--eval") == 0) {
+            evalMode = true;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            checkMode = true;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            emitC = true;
+        } else if (strcmp(argv[i], "--emit-exe") == 0) {
+            emitExe = true;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            dumpIr = true;
+        } else if (strcmp(argv[i], "-O0") == 0) {
+            optimize = false;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            evalMode = true;
+            profilePath = argv[++i];
+        } else if (strcmp(argv[i], "--profile-hz") == 0 && i + 1 < argc) {
+            profileHz = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--native-cache") == 0 && i + 1 < argc) {
+            evalMode = true;
+            cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            parseThreads = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats.enabled = true;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (!filename) {
         fprintf(stderr, "Filename required");
         return 1;
     }
+    if (streamMode) {
+        return run_stream(filename);
+    }
+    stats.filename = filename;
 
     Arena arena = { 0 };
-    const char* code = read_contents_to_string(&arena, argv[1]);
+    int status = 0;
+    u64 start = stats_begin(&stats);
+    const char* code = read_contents_to_string(&arena, filename);
     if (!code) {
-        fprintf(stderr, "There was a problem reading the file");
-        return 1;
+        fprintf(stderr, "There was a problem reading the file\n");
+        return finish_run(&stats, &arena, 1);
     }
+    stats_end(&stats, PhaseLoad, start);
+    stats.bytes = stats.enabled ? strlen(code) : 0;
 
+    start = stats_begin(&stats);
     Token* tokens = lex(&arena, code);
+    stats_end(&stats, PhaseLex, start);
+    stats_count_tokens(&stats, tokens);
 
-    for (int i = 0; tokens[i].kind != TokEof; i++) {
-        printf("%s ", token_to_string(&arena, tokens[i]));
+    if (evalMode || checkMode || emitC || emitExe || dumpIr) {
+        start = stats_begin(&stats);
+        usize itemsCount;
+        Diagnostics diags = { .recover = true };
+        // With -j N, ranges of items are parsed on N threads into `nodes`.
+        ConcurrentArena nodes;
+        carena_init(&nodes);
+        ItemAST* items = parseThreads > 1
+            ? parse_program_parallel(&arena, &nodes, tokens, parseThreads, &itemsCount, &diags)
+            : parse_program(&arena, tokens, &itemsCount, &diags);
+        stats_end(&stats, PhaseParse, start);
+        stats_count_items(&stats, items, itemsCount);
+        if (diags.count > 0) {
+            LineIndex lines;
+            line_index_build(&lines, &arena, code, strlen(code));
+            diagnostics_locate(&diags, &lines);
+            diagnostics_print(stderr, filename, &diags);
+            fprintf(stderr, "%zu error%s\n", diags.count, diags.count == 1 ? "" : "s");
+            status = 1;
+        } else if (dumpIr) {
+            start = stats_begin(&stats);
+            status = dump_ir(items, itemsCount, optimize);
+            stats_end(&stats, PhaseDump, start);
+        } else if (emitC || emitExe) {
+            start = stats_begin(&stats);
+            status = emit_program(items, itemsCount, emitExe, output, optimize);
+            stats_end(&stats, PhaseDump, start);
+        } else if (evalMode) {
+            Evaluator ev;
+            evaluator_init(&ev);
+            ev.module.optimize = optimize;
+            Profiler* profiler = NULL;
+            if (profilePath) {
+                profiler = malloc(sizeof(Profiler));
+                profiler_init(profiler, profileHz);
+                if (profiler_start(profiler)) {
+                    ev.profiler = profiler;
+                }
+            }
+            NativeCache cache;
+            if (cacheDir && native_cache_init(&cache, cacheDir)) {
+                ev.cache = &cache;
+            }
+            start = stats_begin(&stats);
+            if (!eval_items(&ev, items, itemsCount)) {
+                status = 1;
+            }
+            stats_end(&stats, PhaseEval, start);
+            if (ev.cache) {
+                fflush(stdout);
+                fprintf(stderr, "native cache: %llu hits, %llu misses, %llu failed, in %s\n", (unsigned long long)cache.hits,
+                    (unsigned long long)cache.misses, (unsigned long long)cache.failed, cacheDir);
+            }
+            if (profiler) {
+                profiler_stop(profiler);
+                ev.profiler = NULL;
+                write_profile(profilePath, profiler, &ev, &arena, code, filename);
+                profiler_free(profiler);
+                free(profiler);
+            }
+            stats_count_arena(&stats, &ev.arena);
+            evaluator_free(&ev);
+            if (ev.cache) {
+                native_cache_free(&cache);
+            }
+        }
+        for (ArenaThread* t = atomic_load(&nodes.threads); t; t = t->next) {
+            stats_count_arena(&stats, &t->arena);
+        }
+        carena_free(&nodes);
+    } else {
+        start = stats_begin(&stats);
+        Writer out;
+        writer_init(&out, STDOUT_FILENO);
+        print_tokens(&out, tokens);
+        writer_char(&out, '\n');
+        writer_free(&out);
+        stats_end(&stats, PhaseDump, start);
     }
-    printf("\n");
-
-    arena_free(&arena);
-    return 0;
+    return finish_run(&stats, &arena, status);
 }
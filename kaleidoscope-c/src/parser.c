@@ -1,5 +1,10 @@
 #include "parser.h"
+#include "carena.h"
 #include "lexer.h"
+#include "lines.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,7 +12,7 @@
 
 #define LEFT_PAREN                                 \
     (Token) {                                      \
-        .kind = TokOther, .value = {.other = ')' } \
+        .kind = TokOther, .value = {.other = '(' } \
     }
 #define RIGHT_PAREN                                \
     (Token) {                                      \
@@ -18,9 +23,15 @@
         .kind = TokOther, .value = {.other = ',' } \
     }
 
-static void parse_error(const char* msg) {
-    fprintf(stderr, "parse error: %s", msg);
-    exit(1);
+// Errors unwind to the parse_item() frame that is parsing the current
+// item, which records them as a Diagnostic. This keeps the happy path
+// free of error checks and makes the parser safe to run on several threads.
+static _Thread_local jmp_buf* parseErrorJump;
+static _Thread_local const char* parseErrorMessage;
+
+_Noreturn static void parse_error(const char* msg) {
+    parseErrorMessage = msg;
+    longjmp(*parseErrorJump, 1);
 }
 
 static void progress(usize* idx) {
@@ -38,8 +49,9 @@ static bool consume_tok(Token tokens[], usize* idx, const Token token) {
 
 static const char* expect_id(Token tokens[], usize* idx) {
     if (tokens[*idx].kind == TokIdentifier) {
+        const char* identifier = tokens[*idx].value.identifier;
         progress(idx);
-        return tokens[*idx].value.identifier;
+        return identifier;
     }
     return NULL;
 }
@@ -77,12 +89,22 @@ static bool token_char_equals(Token t, char c) {
 }
 
 static usize count_args(Token tokens[], usize idx) {
-    usize count = 0;
-    while (!token_char_equals(tokens[idx], ')')) {
-        if (token_char_equals(tokens[idx], ',')) {
+    if (token_char_equals(tokens[idx], ')')) {
+        return 0;
+    }
+    usize count = 1;
+    usize depth = 0;
+    for (; tokens[idx].kind != TokEof; idx++) {
+        if (token_char_equals(tokens[idx], '(')) {
+            depth++;
+        } else if (token_char_equals(tokens[idx], ')')) {
+            if (depth == 0) {
+                break;
+            }
+            depth--;
+        } else if (depth == 0 && token_char_equals(tokens[idx], ',')) {
             count++;
         }
-        idx++;
     }
     return count;
 }
@@ -98,7 +120,7 @@ static ExprAST* parse_identifier_expr(Arena* a, Token tokens[], usize* idx) {
         expr->value.variableName = identifier;
         return expr;
     }
-    consume_tok(tokens, idx, RIGHT_PAREN);
+    consume_tok(tokens, idx, LEFT_PAREN);
     const usize argsCount = count_args(tokens, *idx);
     ExprAST** args = arena_alloc(a, sizeof(ExprAST*) * argsCount);
     usize argsIdx = 0;
@@ -113,8 +135,8 @@ static ExprAST* parse_identifier_expr(Arena* a, Token tokens[], usize* idx) {
                 parse_error("Expected comma in argument list");
             }
         }
-        consume_tok(tokens, idx, LEFT_PAREN);
     }
+    consume_tok(tokens, idx, RIGHT_PAREN);
     ExprAST* callExpr = arena_alloc(a, sizeof(ExprAST));
     callExpr->type = ExprCallType;
     callExpr->value.call.callee = identifier;
@@ -123,8 +145,31 @@ static ExprAST* parse_identifier_expr(Arena* a, Token tokens[], usize* idx) {
     return callExpr;
 }
 
+static ExprAST* parse_if_expr(Arena* a, Token tokens[], usize* idx) {
+    progress(idx); // eat if
+    ExprAST* cond = parse_expression(a, tokens, idx);
+    if (tokens[*idx].kind != TokThen) {
+        parse_error("Expected then");
+    }
+    progress(idx);
+    ExprAST* then = parse_expression(a, tokens, idx);
+    if (tokens[*idx].kind != TokElse) {
+        parse_error("Expected else");
+    }
+    progress(idx);
+    ExprAST* otherwise = parse_expression(a, tokens, idx);
+    ExprAST* expr = arena_alloc(a, sizeof(ExprAST));
+    expr->type = ExprIfType;
+    expr->value.conditional.cond = cond;
+    expr->value.conditional.then = then;
+    expr->value.conditional.otherwise = otherwise;
+    return expr;
+}
+
 static ExprAST* parse_primary(Arena* a, Token tokens[], usize* idx) {
     switch (tokens[*idx].kind) {
+    case TokIf:
+        return parse_if_expr(a, tokens, idx);
     case TokIdentifier:
         return parse_identifier_expr(a, tokens, idx);
     case TokNumber:
@@ -136,7 +181,6 @@ static ExprAST* parse_primary(Arena* a, Token tokens[], usize* idx) {
         // fallthrough
     default:
         parse_error("Unknown token when expecting expression");
-        return NULL;
     }
 }
 
@@ -196,7 +240,7 @@ ExprAST* parse_expression(Arena* a, Token tokens[], usize* idx) {
 
 static usize count_arg_names(Token tokens[], usize idx) {
     usize count = 0;
-    while (!token_char_equals(tokens[idx++], ')')) {
+    while (tokens[idx++].kind == TokIdentifier) {
         count++;
     }
     return count;
@@ -205,21 +249,293 @@ static usize count_arg_names(Token tokens[], usize idx) {
 static PrototypeAST* parse_prototype(Arena* a, Token tokens[], usize* idx) {
     const char* fnName = expect_id(tokens, idx);
     if (!fnName) {
-        parse_error( "Expected function name");
+        parse_error("Expected function name");
     }
     if (!consume_tok(tokens, idx, LEFT_PAREN)) {
-        parse_error( "Expected open paren");
+        parse_error("Expected open paren");
     }
     const usize argNameCnt = count_arg_names(tokens, *idx);
     const char** argNames = arena_alloc(a, sizeof(char*) * argNameCnt);
     usize i = 0;
-    while (!token_char_equals(tokens[*idx], ')') && tokens[*idx].kind == TokIdentifier) {
+    while (tokens[*idx].kind == TokIdentifier) {
         argNames[i++] = expect_id(tokens, idx);
     }
-    consume_tok(tokens, idx, RIGHT_PAREN);
+    if (!consume_tok(tokens, idx, RIGHT_PAREN)) {
+        parse_error("Expected close paren in prototype");
+    }
     PrototypeAST* proto = arena_alloc(a, sizeof(PrototypeAST));
     proto->name = fnName;
     proto->argsCount = argNameCnt;
     proto->args = argNames;
     return proto;
 }
+
+// ---- Top level ----
+
+static FunctionAST parse_definition(Arena* a, Token tokens[], usize* idx) {
+    progress(idx); // eat def
+    PrototypeAST* proto = parse_prototype(a, tokens, idx);
+    ExprAST* body = parse_expression(a, tokens, idx);
+    return (FunctionAST) { .proto = *proto, .body = body };
+}
+
+static FunctionAST parse_extern(Arena* a, Token tokens[], usize* idx) {
+    progress(idx); // eat extern
+    PrototypeAST* proto = parse_prototype(a, tokens, idx);
+    return (FunctionAST) { .proto = *proto, .body = NULL };
+}
+
+static FunctionAST parse_top_level_expr(Arena* a, Token tokens[], usize* idx) {
+    ExprAST* body = parse_expression(a, tokens, idx);
+    PrototypeAST proto = { .name = ANON_EXPR_NAME, .args = NULL, .argsCount = 0 };
+    return (FunctionAST) { .proto = proto, .body = body };
+}
+
+static bool parse_item(Arena* a, Token tokens[], usize* idx, ItemAST* item, const char** error) {
+    jmp_buf jump;
+    jmp_buf* outer = parseErrorJump;
+    parseErrorJump = &jump;
+    if (setjmp(jump)) {
+        parseErrorJump = outer;
+        *error = parseErrorMessage;
+        return false;
+    }
+    usize start = tokens[*idx].start;
+    switch (tokens[*idx].kind) {
+    case TokDef:
+        item->type = ItemDefType;
+        item->fn = parse_definition(a, tokens, idx);
+        break;
+    case TokExtern:
+        item->type = ItemExternType;
+        item->fn = parse_extern(a, tokens, idx);
+        break;
+    default:
+        item->type = ItemExprType;
+        item->fn = parse_top_level_expr(a, tokens, idx);
+        break;
+    }
+    item->fn.start = start;
+    parseErrorJump = outer;
+    return true;
+}
+
+static void add_diagnostic(Arena* a, Diagnostics* diags, const char* message, Token tokens[], usize idx) {
+    if (diags->count == diags->capacity) {
+        usize capacity = diags->capacity ? diags->capacity * 2 : 8;
+        diags->items = arena_realloc(a, diags->items, sizeof(Diagnostic) * diags->capacity, sizeof(Diagnostic) * capacity);
+        diags->capacity = capacity;
+    }
+    diags->items[diags->count++] = (Diagnostic) {
+        .message = message,
+        .token = idx,
+        .offset = tokens[idx].start,
+    };
+}
+
+// Skip the rest of a broken item: up to and including the next `;`, or up
+// to the next `def`/`extern`. Always moves past the item's first token so a
+// malformed `def` cannot be retried forever.
+static usize resync(Token tokens[], usize itemStart, usize idx) {
+    if (idx == itemStart) {
+        idx++;
+    }
+    while (tokens[idx].kind != TokEof) {
+        if (tokens[idx].kind == TokDef || tokens[idx].kind == TokExtern) {
+            break;
+        }
+        if (token_char_equals(tokens[idx++], ';')) {
+            break;
+        }
+    }
+    return idx;
+}
+
+// Parse the items in tokens[begin, end), stopping early at Eof.
+static ItemAST* parse_range(Arena* a, Token tokens[], usize begin, usize end, usize* itemsCount, Diagnostics* diags) {
+    usize capacity = 8;
+    usize count = 0;
+    ItemAST* items = arena_alloc(a, sizeof(ItemAST) * capacity);
+    usize idx = begin;
+    *diags = (Diagnostics) { .recover = diags->recover };
+    while (true) {
+        while (idx < end && token_char_equals(tokens[idx], ';')) {
+            progress(&idx);
+        }
+        if (idx >= end || tokens[idx].kind == TokEof) {
+            break;
+        }
+        if (count == capacity) {
+            items = arena_realloc(a, items, sizeof(ItemAST) * capacity, sizeof(ItemAST) * capacity * 2);
+            capacity *= 2;
+        }
+        usize itemStart = idx;
+        const char* error;
+        if (!parse_item(a, tokens, &idx, &items[count], &error)) {
+            add_diagnostic(a, diags, error, tokens, idx);
+            if (!diags->recover) {
+                break;
+            }
+            idx = resync(tokens, itemStart, idx);
+            continue;
+        }
+        count++;
+    }
+    *itemsCount = count;
+    return items;
+}
+
+// Parse top-level items up to Eof. Errors are appended to `diags`; unless
+// diags->recover is set, parsing stops at the first one and the items
+// before it are returned.
+ItemAST* parse_program(Arena* a, Token tokens[], usize* itemsCount, Diagnostics* diags) {
+    return parse_range(a, tokens, 0, SIZE_MAX, itemsCount, diags);
+}
+
+// ---- Parallel parsing ----
+
+// Below this many tokens per range, threads cost more than they save.
+#define PARSE_RANGE_MIN_TOKENS (16 * 1024)
+
+// A run of whole items, parsed by whichever worker claims it.
+typedef struct {
+    usize begin;
+    usize end;
+    ItemAST* items;
+    usize itemsCount;
+    Diagnostics diags;
+} ParseRange;
+
+typedef struct {
+    Token* tokens;
+    ParseRange* ranges;
+    usize rangesCount;
+    _Atomic(usize) next; // first unclaimed range
+    _Atomic(usize) failed; // first range with an error, unless recovering
+    ConcurrentArena* nodes;
+    bool recover;
+} ParallelParse;
+
+// Cut the token stream into about `parts` ranges of whole items. No item
+// contains a `;` or a `def`/`extern`, so every `;` ends one and every
+// `def`/`extern` starts one: the cuts go right after the first `;`, or
+// right before the first `def`/`extern`, past each even share.
+static ParseRange* split_items(Arena* a, Token tokens[], usize parts, usize* rangesCount) {
+    usize tokensCount = 0;
+    while (tokens[tokensCount].kind != TokEof) {
+        tokensCount++;
+    }
+    usize share = tokensCount / parts;
+    if (share < PARSE_RANGE_MIN_TOKENS) {
+        share = PARSE_RANGE_MIN_TOKENS;
+    }
+    ParseRange* ranges = arena_alloc(a, sizeof(ParseRange) * (tokensCount / share + 1));
+    usize count = 0;
+    usize begin = 0;
+    for (usize idx = share; idx < tokensCount; idx++) {
+        usize cut;
+        if (tokens[idx].kind == TokDef || tokens[idx].kind == TokExtern) {
+            cut = idx;
+        } else if (token_char_equals(tokens[idx], ';')) {
+            cut = idx + 1;
+        } else {
+            continue;
+        }
+        ranges[count++] = (ParseRange) { .begin = begin, .end = cut };
+        begin = cut;
+        idx = cut + share - 1;
+    }
+    ranges[count++] = (ParseRange) { .begin = begin, .end = SIZE_MAX };
+    *rangesCount = count;
+    return ranges;
+}
+
+static void* parse_worker(void* arg) {
+    ParallelParse* pp = arg;
+    ArenaThread* t = carena_thread(pp->nodes);
+    usize r;
+    while ((r = atomic_fetch_add(&pp->next, 1)) < pp->rangesCount) {
+        if (r > atomic_load(&pp->failed)) {
+            break; // past the first error, which ends the parse
+        }
+        ParseRange* range = &pp->ranges[r];
+        range->diags.recover = pp->recover;
+        range->items = parse_range(&t->arena, pp->tokens, range->begin, range->end, &range->itemsCount, &range->diags);
+        if (!pp->recover && range->diags.count > 0) {
+            usize failed = atomic_load(&pp->failed);
+            while (r < failed && !atomic_compare_exchange_weak(&pp->failed, &failed, r)) { }
+        }
+    }
+    return NULL;
+}
+
+// parse_program() on `threads` threads: item ranges are parsed into the
+// per-thread arenas of `nodes`, then their items and diagnostics are
+// concatenated in source order into `a`. The result is the same as
+// parse_program()'s; `nodes` must outlive the AST.
+ItemAST* parse_program_parallel(Arena* a, ConcurrentArena* nodes, Token tokens[], usize threads, usize* itemsCount, Diagnostics* diags) {
+    ParallelParse pp = { .tokens = tokens, .nodes = nodes, .recover = diags->recover };
+    pp.ranges = split_items(a, tokens, threads * 4, &pp.rangesCount);
+    atomic_init(&pp.next, 0);
+    atomic_init(&pp.failed, SIZE_MAX);
+    if (threads > pp.rangesCount) {
+        threads = pp.rangesCount;
+    }
+    pthread_t* workers = arena_alloc(a, sizeof(pthread_t) * threads);
+    for (usize w = 1; w < threads; w++) {
+        pthread_create(&workers[w], NULL, parse_worker, &pp);
+    }
+    parse_worker(&pp);
+    for (usize w = 1; w < threads; w++) {
+        pthread_join(workers[w], NULL);
+    }
+
+    usize last = atomic_load(&pp.failed);
+    if (last >= pp.rangesCount) {
+        last = pp.rangesCount - 1;
+    }
+    usize count = 0;
+    usize diagsCount = 0;
+    for (usize r = 0; r <= last; r++) {
+        count += pp.ranges[r].itemsCount;
+        diagsCount += pp.ranges[r].diags.count;
+    }
+    ItemAST* items = arena_alloc(a, sizeof(ItemAST) * (count ? count : 1));
+    *diags = (Diagnostics) { .recover = diags->recover };
+    if (diagsCount > 0) {
+        diags->items = arena_alloc(a, sizeof(Diagnostic) * diagsCount);
+        diags->capacity = diagsCount;
+    }
+    count = 0;
+    for (usize r = 0; r <= last; r++) {
+        const ParseRange* range = &pp.ranges[r];
+        memcpy(items + count, range->items, sizeof(ItemAST) * range->itemsCount);
+        count += range->itemsCount;
+        if (range->diags.count > 0) {
+            memcpy(diags->items + diags->count, range->diags.items, sizeof(Diagnostic) * range->diags.count);
+            diags->count += range->diags.count;
+        }
+    }
+    *itemsCount = count;
+    return items;
+}
+
+void diagnostics_locate(Diagnostics* diags, const LineIndex* lines) {
+    for (usize i = 0; i < diags->count; i++) {
+        Diagnostic* d = &diags->items[i];
+        line_index_locate(lines, d->offset, &d->line, &d->column);
+    }
+}
+
+// One `file:line:col: error: message` per diagnostic; without line
+// information (streamed input) the byte offset is shown instead.
+void diagnostics_print(FILE* out, const char* filename, const Diagnostics* diags) {
+    for (usize i = 0; i < diags->count; i++) {
+        const Diagnostic* d = &diags->items[i];
+        if (d->line) {
+            fprintf(out, "%s:%zu:%zu: error: %s\n", filename, d->line, d->column, d->message);
+        } else {
+            fprintf(out, "%s:+%zu: error: %s\n", filename, d->offset, d->message);
+        }
+    }
+}
@@ -1,13 +1,18 @@
 #pragma once
 
 #include "arena.h"
+#include "carena.h"
+#include "lexer.h"
+#include "lines.h"
 #include "types.h"
+#include <stdio.h>
 
 typedef enum {
     ExprNumberType,
     ExprVariableType,
     ExprBinopType,
-    ExprCallType
+    ExprCallType,
+    ExprIfType
 } ExprType;
 
 typedef struct ExprAST {
@@ -26,6 +31,11 @@ typedef struct ExprAST {
             struct ExprAST** args;
             usize argsCount;
         } call;
+        struct {
+            struct ExprAST* cond;
+            struct ExprAST* then;
+            struct ExprAST* otherwise;
+        } conditional;
     } value;
 } ExprAST;
 
@@ -38,4 +48,44 @@ typedef struct {
 typedef struct {
     PrototypeAST proto;
     ExprAST* body;
+    usize start; // byte offset of the item in the input
 } FunctionAST;
+
+// Top-level expressions are wrapped in a nullary function of this name.
+#define ANON_EXPR_NAME "__anon_expr"
+
+typedef enum {
+    ItemDefType,
+    ItemExternType,
+    ItemExprType
+} ItemType;
+
+// A top-level `def`, `extern` (body is NULL) or expression.
+typedef struct {
+    ItemType type;
+    FunctionAST fn;
+} ItemAST;
+
+typedef struct {
+    const char* message;
+    usize token; // index of the offending token
+    usize offset; // its byte offset in the input
+    // Filled in by diagnostics_locate(); 1-based.
+    usize line;
+    usize column;
+} Diagnostic;
+
+// Parse errors, in input order, allocated in the parse arena.
+typedef struct {
+    Diagnostic* items;
+    usize count;
+    usize capacity;
+    // Skip to the next `;`, `def` or `extern` after an error and keep
+    // parsing, instead of stopping at the first one.
+    bool recover;
+} Diagnostics;
+
+ItemAST* parse_program(Arena* a, Token tokens[], usize* itemsCount, Diagnostics* diags);
+ItemAST* parse_program_parallel(Arena* a, ConcurrentArena* nodes, Token tokens[], usize threads, usize* itemsCount, Diagnostics* diags);
+void diagnostics_locate(Diagnostics* diags, const LineIndex* lines);
+void diagnostics_print(FILE* out, const char* filename, const Diagnostics* diags);
@@ -0,0 +1,888 @@
+#include "ir.h"
+#include "arena.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Callees with at most this many instructions are inlined...
+#define INLINE_MAX_INSTS 24
+// ...into callers that have not yet grown past this many.
+#define INLINE_BUDGET 4096
+// Rounds of the whole pipeline, stopping early once nothing changes.
+#define OPTIMIZE_ROUNDS 3
+
+// ---- Utilities ----
+
+static u32 successors(const IrTerm* term, u32 out[2]) {
+    switch (term->kind) {
+    case IrJump:
+        out[0] = term->targets[0];
+        return 1;
+    case IrBranch:
+        out[0] = term->targets[0];
+        out[1] = term->targets[1];
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static u32 pred_index(const IrBlock* block, u32 pred) {
+    for (u32 i = 0; i < block->predsCount; i++) {
+        if (block->preds[i] == pred) {
+            return i;
+        }
+    }
+    return IR_NONE;
+}
+
+// Drop predecessor `k` of `block` along with its phi operands.
+static void remove_pred(IrFunction* fn, u32 block, u32 k) {
+    IrBlock* b = &fn->blocks[block];
+    for (u32 i = 0; i < b->instsCount; i++) {
+        IrInst* inst = &fn->insts[b->insts[i]];
+        if (inst->op == IrPhi) {
+            IrValue* operands = fn->operands + inst->value.phi;
+            memmove(operands + k, operands + k + 1, sizeof(IrValue) * (b->predsCount - k - 1));
+        }
+    }
+    memmove(b->preds + k, b->preds + k + 1, sizeof(u32) * (b->predsCount - k - 1));
+    b->predsCount--;
+}
+
+static void replace_pred(IrFunction* fn, u32 block, u32 from, u32 to) {
+    IrBlock* b = &fn->blocks[block];
+    u32 k = pred_index(b, from);
+    if (k != IR_NONE) {
+        b->preds[k] = to;
+    }
+}
+
+static void replace_uses(IrFunction* fn, IrValue from, IrValue to) {
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        IrBlock* b = &fn->blocks[bi];
+        if (b->dead) {
+            continue;
+        }
+        for (u32 i = 0; i < b->instsCount; i++) {
+            IrInst* inst = &fn->insts[b->insts[i]];
+            u32 count = ir_operand_count(fn, inst, bi);
+            IrValue* operands = ir_operands(fn, inst);
+            for (u32 o = 0; o < count; o++) {
+                if (operands[o] == from) {
+                    operands[o] = to;
+                }
+            }
+        }
+        if (b->term.value == from) {
+            b->term.value = to;
+        }
+    }
+}
+
+static bool is_self_call(const IrFunction* fn, u32 index, IrValue value, u32 paramsCount) {
+    const IrInst* inst = &fn->insts[value];
+    return inst->op == IrCall && inst->value.call.callee == index && inst->value.call.count == paramsCount;
+}
+
+// ---- CFG simplification ----
+
+// Fold branches on constants, drop unreachable blocks and merge blocks
+// into their only predecessor. Block 0 is never merged into.
+static bool simplify_cfg(IrModule* m, u32 index) {
+    IrFunction* fn = m->functions[index];
+    bool changed = false;
+
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        IrTerm* term = &fn->blocks[bi].term;
+        if (fn->blocks[bi].dead || term->kind != IrBranch || fn->insts[term->value].op != IrConst) {
+            continue;
+        }
+        bool taken = fn->insts[term->value].value.number != 0.0;
+        u32 target = term->targets[taken ? 0 : 1];
+        u32 other = term->targets[taken ? 1 : 0];
+        u32 k = pred_index(&fn->blocks[other], bi);
+        if (other != target && k != IR_NONE) {
+            remove_pred(fn, other, k);
+        }
+        *term = (IrTerm) { .kind = IrJump, .value = IR_NONE, .targets = { target } };
+        changed = true;
+    }
+
+    bool* reachable = calloc(fn->blocksCount, sizeof(bool));
+    u32* stack = malloc(sizeof(u32) * fn->blocksCount);
+    u32 top = 0;
+    stack[top++] = 0;
+    reachable[0] = true;
+    while (top > 0) {
+        u32 succ[2];
+        u32 count = successors(&fn->blocks[stack[--top]].term, succ);
+        for (u32 s = 0; s < count; s++) {
+            if (!reachable[succ[s]]) {
+                reachable[succ[s]] = true;
+                stack[top++] = succ[s];
+            }
+        }
+    }
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        if (reachable[bi] || fn->blocks[bi].dead) {
+            continue;
+        }
+        u32 succ[2];
+        u32 count = successors(&fn->blocks[bi].term, succ);
+        for (u32 s = 0; s < count; s++) {
+            if (reachable[succ[s]]) {
+                remove_pred(fn, succ[s], pred_index(&fn->blocks[succ[s]], bi));
+            }
+        }
+        fn->blocks[bi].dead = true;
+        changed = true;
+    }
+    free(stack);
+    free(reachable);
+
+    for (u32 bi = 1; bi < fn->blocksCount; bi++) {
+        IrBlock* b = &fn->blocks[bi];
+        if (b->dead || b->predsCount != 1) {
+            continue;
+        }
+        u32 pi = b->preds[0];
+        IrBlock* p = &fn->blocks[pi];
+        if (pi == 0 || pi == bi || p->term.kind != IrJump) {
+            continue;
+        }
+        for (u32 i = 0; i < b->instsCount; i++) {
+            IrValue v = b->insts[i];
+            if (fn->insts[v].op == IrPhi) {
+                replace_uses(fn, v, fn->operands[fn->insts[v].value.phi]);
+            } else {
+                ir_append(m, fn, pi, v);
+            }
+        }
+        p = &fn->blocks[pi];
+        p->term = b->term;
+        u32 succ[2];
+        u32 count = successors(&b->term, succ);
+        for (u32 s = 0; s < count; s++) {
+            replace_pred(fn, succ[s], bi, pi);
+        }
+        b->dead = true;
+        changed = true;
+    }
+    return changed;
+}
+
+// ---- Global value numbering ----
+
+typedef struct {
+    IrFunction* fn;
+    IrValue* forward; // replacement for each value, itself if none
+    u32* children; // dominator tree, CSR
+    u32* childrenStart;
+    IrValue* table; // open addressing over values
+    u32 tableCapacity;
+    u32* undo; // table slots filled, innermost scope last
+    u32 undoCount;
+    bool changed;
+} Gvn;
+
+static IrValue resolve(const Gvn* g, IrValue v) {
+    while (g->forward[v] != v) {
+        v = g->forward[v];
+    }
+    return v;
+}
+
+static bool is_commutative(IrOp op) {
+    return op == IrAdd || op == IrMul;
+}
+
+static u64 inst_hash(const IrInst* inst) {
+    u64 hash = inst->op * 0x9e3779b97f4a7c15ull;
+    switch (inst->op) {
+    case IrConst: {
+        u64 bits;
+        memcpy(&bits, &inst->value.number, sizeof(bits));
+        return (hash ^ bits) * 0xff51afd7ed558ccdull;
+    }
+    case IrParam:
+        return (hash ^ inst->value.param) * 0xff51afd7ed558ccdull;
+    default:
+        hash = (hash ^ inst->value.operands[0]) * 0xff51afd7ed558ccdull;
+        return (hash ^ inst->value.operands[1]) * 0xc4ceb9fe1a85ec53ull;
+    }
+}
+
+static bool inst_equal(const IrInst* a, const IrInst* b) {
+    if (a->op != b->op) {
+        return false;
+    }
+    switch (a->op) {
+    case IrConst:
+        return memcmp(&a->value.number, &b->value.number, sizeof(double)) == 0;
+    case IrParam:
+        return a->value.param == b->value.param;
+    default:
+        return a->value.operands[0] == b->value.operands[0] && a->value.operands[1] == b->value.operands[1];
+    }
+}
+
+// Fold `inst` in place when its operands are constants. Returns the value
+// it simplifies to, or IR_NONE.
+static IrValue fold(Gvn* g, IrValue v) {
+    IrInst* inst = &g->fn->insts[v];
+    IrInst* lhs = &g->fn->insts[inst->value.operands[0]];
+    IrInst* rhs = &g->fn->insts[inst->value.operands[1]];
+    if (lhs->op == IrConst && rhs->op == IrConst) {
+        double a = lhs->value.number;
+        double b = rhs->value.number;
+        double result = inst->op == IrAdd ? a + b
+            : inst->op == IrSub         ? a - b
+            : inst->op == IrMul         ? a * b
+                                        : (a < b ? 1.0 : 0.0);
+        *inst = (IrInst) { .op = IrConst, .value = { .number = result } };
+        return IR_NONE;
+    }
+    // x - 0 and x * 1 are exact; x + 0 is not for x = -0.
+    if (inst->op == IrSub && rhs->op == IrConst && rhs->value.number == 0.0) {
+        return inst->value.operands[0];
+    }
+    if (inst->op == IrMul && rhs->op == IrConst && rhs->value.number == 1.0) {
+        return inst->value.operands[0];
+    }
+    if (inst->op == IrMul && lhs->op == IrConst && lhs->value.number == 1.0) {
+        return inst->value.operands[1];
+    }
+    return IR_NONE;
+}
+
+static void number_block(Gvn* g, u32 bi) {
+    IrFunction* fn = g->fn;
+    IrBlock* b = &fn->blocks[bi];
+    u32 scope = g->undoCount;
+    u32 kept = 0;
+    for (u32 i = 0; i < b->instsCount; i++) {
+        IrValue v = b->insts[i];
+        IrInst* inst = &fn->insts[v];
+        u32 count = ir_operand_count(fn, inst, bi);
+        IrValue* operands = ir_operands(fn, inst);
+        for (u32 o = 0; o < count; o++) {
+            operands[o] = resolve(g, operands[o]);
+        }
+
+        IrValue same = IR_NONE;
+        if (inst->op == IrPhi) {
+            // A phi whose operands are all one value (or itself) is that value.
+            for (u32 o = 0; o < count; o++) {
+                if (operands[o] == v || operands[o] == same) {
+                    continue;
+                }
+                same = same == IR_NONE ? operands[o] : IR_NONE - 1;
+            }
+            if (same == IR_NONE - 1) {
+                same = IR_NONE;
+            }
+        } else if (inst->op != IrCall) {
+            if (inst->op != IrConst && inst->op != IrParam) {
+                if (is_commutative(inst->op) && operands[0] > operands[1]) {
+                    IrValue t = operands[0];
+                    operands[0] = operands[1];
+                    operands[1] = t;
+                }
+                same = fold(g, v);
+            }
+            if (same == IR_NONE) {
+                u32 slot = inst_hash(inst) & (g->tableCapacity - 1);
+                while (g->table[slot] != IR_NONE && !inst_equal(&fn->insts[g->table[slot]], inst)) {
+                    slot = (slot + 1) & (g->tableCapacity - 1);
+                }
+                if (g->table[slot] != IR_NONE) {
+                    same = g->table[slot];
+                } else {
+                    g->table[slot] = v;
+                    g->undo[g->undoCount++] = slot;
+                }
+            }
+        }
+        if (same != IR_NONE) {
+            g->forward[v] = same;
+            g->changed = true;
+        } else {
+            b->insts[kept++] = v;
+        }
+    }
+    b->instsCount = kept;
+    if (b->term.value != IR_NONE) {
+        b->term.value = resolve(g, b->term.value);
+    }
+
+    for (u32 c = g->childrenStart[bi]; c < g->childrenStart[bi + 1]; c++) {
+        number_block(g, g->children[c]);
+    }
+    // Leaving the subtree: forget its values. Linear probing tolerates
+    // removal in reverse insertion order.
+    while (g->undoCount > scope) {
+        g->table[g->undo[--g->undoCount]] = IR_NONE;
+    }
+}
+
+static u32 intersect(const u32* idom, const u32* order, u32 a, u32 b) {
+    while (a != b) {
+        while (order[a] > order[b]) {
+            a = idom[a];
+        }
+        while (order[b] > order[a]) {
+            b = idom[b];
+        }
+    }
+    return a;
+}
+
+// Dominator-scoped value numbering with constant folding: an instruction
+// equal to one in a dominating block is replaced by it.
+static bool value_numbering(IrModule* m, u32 index) {
+    IrFunction* fn = m->functions[index];
+    u32 n = fn->blocksCount;
+
+    // Reverse postorder from block 0.
+    u32* rpo = malloc(sizeof(u32) * n);
+    u32* order = malloc(sizeof(u32) * n); // position in rpo
+    u8* state = calloc(n, 1);
+    u32* stack = malloc(sizeof(u32) * n * 2);
+    u32 top = 0;
+    u32 visited = n;
+    stack[top++] = 0;
+    state[0] = 1;
+    while (top > 0) {
+        u32 bi = stack[top - 1];
+        u32 succ[2];
+        u32 count = successors(&fn->blocks[bi].term, succ);
+        bool pushed = false;
+        for (u32 s = 0; s < count && !pushed; s++) {
+            if (!state[succ[s]]) {
+                state[succ[s]] = 1;
+                stack[top++] = succ[s];
+                pushed = true;
+            }
+        }
+        if (!pushed) {
+            top--;
+            rpo[--visited] = bi;
+        }
+    }
+    u32 reachable = n - visited;
+    rpo += visited;
+    for (u32 i = 0; i < n; i++) {
+        order[i] = IR_NONE;
+    }
+    for (u32 i = 0; i < reachable; i++) {
+        order[rpo[i]] = i;
+    }
+
+    // Cooper, Harvey and Kennedy's iterative dominators.
+    u32* idom = malloc(sizeof(u32) * n);
+    for (u32 i = 0; i < n; i++) {
+        idom[i] = IR_NONE;
+    }
+    idom[0] = 0;
+    for (bool moved = true; moved;) {
+        moved = false;
+        for (u32 i = 1; i < reachable; i++) {
+            u32 bi = rpo[i];
+            u32 next = IR_NONE;
+            for (u32 p = 0; p < fn->blocks[bi].predsCount; p++) {
+                u32 pred = fn->blocks[bi].preds[p];
+                if (order[pred] == IR_NONE || idom[pred] == IR_NONE) {
+                    continue;
+                }
+                next = next == IR_NONE ? pred : intersect(idom, order, pred, next);
+            }
+            if (idom[bi] != next) {
+                idom[bi] = next;
+                moved = true;
+            }
+        }
+    }
+
+    Gvn g = { .fn = fn };
+    g.childrenStart = calloc(n + 1, sizeof(u32));
+    g.children = malloc(sizeof(u32) * (reachable + 1));
+    for (u32 i = 1; i < reachable; i++) {
+        g.childrenStart[idom[rpo[i]] + 1]++;
+    }
+    for (u32 i = 0; i < n; i++) {
+        g.childrenStart[i + 1] += g.childrenStart[i];
+    }
+    u32* fill = malloc(sizeof(u32) * (n + 1));
+    memcpy(fill, g.childrenStart, sizeof(u32) * (n + 1));
+    for (u32 i = 1; i < reachable; i++) {
+        g.children[fill[idom[rpo[i]]]++] = rpo[i];
+    }
+
+    g.forward = malloc(sizeof(IrValue) * fn->instsCount);
+    for (u32 v = 0; v < fn->instsCount; v++) {
+        g.forward[v] = v;
+    }
+    g.tableCapacity = 16;
+    while (g.tableCapacity < fn->instsCount * 2) {
+        g.tableCapacity *= 2;
+    }
+    g.table = malloc(sizeof(IrValue) * g.tableCapacity);
+    memset(g.table, 0xff, sizeof(IrValue) * g.tableCapacity);
+    g.undo = malloc(sizeof(u32) * (fn->instsCount + 1));
+    number_block(&g, 0);
+
+    // Phi operands on back edges were numbered before their definitions.
+    if (g.changed) {
+        for (u32 bi = 0; bi < n; bi++) {
+            IrBlock* b = &fn->blocks[bi];
+            if (b->dead) {
+                continue;
+            }
+            for (u32 i = 0; i < b->instsCount; i++) {
+                IrInst* inst = &fn->insts[b->insts[i]];
+                u32 count = ir_operand_count(fn, inst, bi);
+                IrValue* operands = ir_operands(fn, inst);
+                for (u32 o = 0; o < count; o++) {
+                    operands[o] = resolve(&g, operands[o]);
+                }
+            }
+            if (b->term.value != IR_NONE) {
+                b->term.value = resolve(&g, b->term.value);
+            }
+        }
+    }
+
+    free(g.undo);
+    free(g.table);
+    free(g.forward);
+    free(fill);
+    free(g.children);
+    free(g.childrenStart);
+    free(idom);
+    free(stack);
+    free(state);
+    free(order);
+    free(rpo - visited);
+    return g.changed;
+}
+
+// ---- Dead code elimination ----
+
+// Keep what terminators and calls (which may have side effects) depend on.
+static bool eliminate_dead_code(IrModule* m, u32 index) {
+    IrFunction* fn = m->functions[index];
+    u32* blockOf = malloc(sizeof(u32) * fn->instsCount);
+    bool* live = calloc(fn->instsCount, sizeof(bool));
+    IrValue* work = malloc(sizeof(IrValue) * fn->instsCount);
+    u32 top = 0;
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        IrBlock* b = &fn->blocks[bi];
+        if (b->dead) {
+            continue;
+        }
+        for (u32 i = 0; i < b->instsCount; i++) {
+            IrValue v = b->insts[i];
+            blockOf[v] = bi;
+            if (fn->insts[v].op == IrCall && !live[v]) {
+                live[v] = true;
+                work[top++] = v;
+            }
+        }
+        IrValue v = b->term.value;
+        if (b->term.kind != IrJump && v != IR_NONE && !live[v]) {
+            live[v] = true;
+            work[top++] = v;
+        }
+    }
+    while (top > 0) {
+        IrValue v = work[--top];
+        IrInst* inst = &fn->insts[v];
+        u32 count = ir_operand_count(fn, inst, blockOf[v]);
+        IrValue* operands = ir_operands(fn, inst);
+        for (u32 o = 0; o < count; o++) {
+            if (!live[operands[o]]) {
+                live[operands[o]] = true;
+                work[top++] = operands[o];
+            }
+        }
+    }
+
+    bool changed = false;
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        IrBlock* b = &fn->blocks[bi];
+        u32 kept = 0;
+        for (u32 i = 0; i < b->instsCount; i++) {
+            if (live[b->insts[i]]) {
+                b->insts[kept++] = b->insts[i];
+            }
+        }
+        changed |= kept != b->instsCount;
+        b->instsCount = kept;
+    }
+    free(work);
+    free(live);
+    free(blockOf);
+    return changed;
+}
+
+// ---- Inlining ----
+
+static u32 live_inst_count(const IrFunction* fn) {
+    u32 count = 0;
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        if (!fn->blocks[bi].dead) {
+            count += fn->blocks[bi].instsCount;
+        }
+    }
+    return count;
+}
+
+static bool calls_itself(const IrFunction* fn, u32 index) {
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        const IrBlock* b = &fn->blocks[bi];
+        for (u32 i = 0; !b->dead && i < b->instsCount; i++) {
+            const IrInst* inst = &fn->insts[b->insts[i]];
+            if (inst->op == IrCall && inst->value.call.callee == index) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void add_inlined(IrModule* m, IrFunction* fn, u32 callee) {
+    for (u32 i = 0; i < fn->inlinedCount; i++) {
+        if (fn->inlined[i] == callee) {
+            return;
+        }
+    }
+    fn->inlined = arena_realloc(&m->arena, fn->inlined, sizeof(u32) * fn->inlinedCount, sizeof(u32) * (fn->inlinedCount + 1));
+    fn->inlined[fn->inlinedCount++] = callee;
+}
+
+// Replace the call at insts[pos] of block `bi` with a copy of the callee's
+// body. The rest of the block moves to a new continuation block, which is
+// returned; the callee's returns jump there and meet in a phi.
+static u32 inline_call(IrModule* m, u32 index, u32 bi, u32 pos) {
+    IrFunction* fn = m->functions[index];
+    IrValue call = fn->blocks[bi].insts[pos];
+    u32 callee = fn->insts[call].value.call.callee;
+    const IrFunction* g = m->functions[callee];
+    u32 argsCount = fn->insts[call].value.call.count;
+    IrValue* args = malloc(sizeof(IrValue) * (argsCount + 1));
+    memcpy(args, fn->operands + fn->insts[call].value.call.first, sizeof(IrValue) * argsCount);
+
+    u32 cont = ir_new_block(m, fn);
+    for (u32 i = pos + 1; i < fn->blocks[bi].instsCount; i++) {
+        ir_append(m, fn, cont, fn->blocks[bi].insts[i]);
+    }
+    fn->blocks[cont].term = fn->blocks[bi].term;
+    fn->blocks[bi].instsCount = pos;
+    u32 succ[2];
+    u32 count = successors(&fn->blocks[cont].term, succ);
+    for (u32 s = 0; s < count; s++) {
+        replace_pred(fn, succ[s], bi, cont);
+    }
+
+    u32 base = fn->blocksCount;
+    for (u32 gb = 0; gb < g->blocksCount; gb++) {
+        ir_new_block(m, fn);
+        fn->blocks[base + gb].dead = g->blocks[gb].dead;
+    }
+    IrValue* map = malloc(sizeof(IrValue) * (g->instsCount + 1));
+    for (u32 gb = 0; gb < g->blocksCount; gb++) {
+        const IrBlock* b = &g->blocks[gb];
+        for (u32 i = 0; !b->dead && i < b->instsCount; i++) {
+            IrValue v = b->insts[i];
+            map[v] = g->insts[v].op == IrParam ? args[g->insts[v].value.param] : ir_new_inst(m, fn, g->insts[v]);
+        }
+    }
+
+    IrValue* returns = malloc(sizeof(IrValue) * (g->blocksCount + 1));
+    u32 returnsCount = 0;
+    for (u32 gb = 0; gb < g->blocksCount; gb++) {
+        const IrBlock* b = &g->blocks[gb];
+        u32 nb = base + gb;
+        if (b->dead) {
+            continue;
+        }
+        for (u32 p = 0; p < b->predsCount; p++) {
+            ir_add_pred(m, fn, nb, base + b->preds[p]);
+        }
+        for (u32 i = 0; i < b->instsCount; i++) {
+            IrValue v = b->insts[i];
+            const IrInst* inst = &g->insts[v];
+            if (inst->op == IrParam) {
+                continue;
+            }
+            IrInst* copy = &fn->insts[map[v]];
+            u32 operandsCount = ir_operand_count(g, inst, gb);
+            const IrValue* operands = ir_operands((IrFunction*)g, (IrInst*)inst);
+            if (inst->op == IrCall || inst->op == IrPhi) {
+                u32 first = fn->operandsCount;
+                for (u32 o = 0; o < operandsCount; o++) {
+                    IrValue mapped = map[operands[o]];
+                    ir_push_operands(m, fn, &mapped, 1);
+                }
+                copy = &fn->insts[map[v]];
+                if (inst->op == IrCall) {
+                    copy->value.call.first = first;
+                } else {
+                    copy->value.phi = first;
+                }
+            } else {
+                for (u32 o = 0; o < operandsCount; o++) {
+                    copy->value.operands[o] = map[operands[o]];
+                }
+            }
+            ir_append(m, fn, nb, map[v]);
+        }
+        IrTerm term = b->term;
+        if (term.kind == IrReturn) {
+            returns[returnsCount++] = map[term.value];
+            fn->blocks[nb].term = (IrTerm) { .kind = IrJump, .value = IR_NONE, .targets = { cont } };
+            ir_add_pred(m, fn, cont, nb);
+            continue;
+        }
+        if (term.kind == IrBranch) {
+            term.value = map[term.value];
+        }
+        term.targets[0] += base;
+        term.targets[1] += base;
+        fn->blocks[nb].term = term;
+    }
+
+    fn->blocks[bi].term = (IrTerm) { .kind = IrJump, .value = IR_NONE, .targets = { base } };
+    ir_add_pred(m, fn, base, bi);
+
+    IrValue result = returns[0];
+    if (returnsCount > 1) {
+        IrInst phi = { .op = IrPhi };
+        phi.value.phi = ir_push_operands(m, fn, returns, returnsCount);
+        result = ir_new_inst(m, fn, phi);
+        ir_append(m, fn, cont, result);
+        IrBlock* c = &fn->blocks[cont];
+        memmove(c->insts + 1, c->insts, sizeof(IrValue) * (c->instsCount - 1));
+        c->insts[0] = result;
+    }
+    replace_uses(fn, call, result);
+
+    add_inlined(m, fn, callee);
+    for (u32 i = 0; i < g->inlinedCount; i++) {
+        add_inlined(m, fn, g->inlined[i]);
+    }
+    free(returns);
+    free(map);
+    free(args);
+    return cont;
+}
+
+static bool has_return(const IrFunction* fn) {
+    for (u32 bi = 0; bi < fn->blocksCount; bi++) {
+        if (!fn->blocks[bi].dead && fn->blocks[bi].term.kind == IrReturn) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool should_inline(IrModule* m, u32 index, const IrInst* call) {
+    u32 callee = call->value.call.callee;
+    const IrFunction* g = m->functions[callee];
+    if (callee == index || !g->defined || g->isExtern || call->value.call.count != g->paramsCount) {
+        return false;
+    }
+    // A lazily defined callee is lowered, but not optimized, on demand; if
+    // that fails the call is left to report the error when it runs.
+    const char* error;
+    if (!g->lowered && !ir_lower(m, callee, &error)) {
+        return false;
+    }
+    return live_inst_count(g) <= INLINE_MAX_INSTS && !calls_itself(g, callee) && has_return(g);
+}
+
+// Inline calls to small, non-recursive, already defined functions.
+static bool inline_calls(IrModule* m, u32 index) {
+    IrFunction* fn = m->functions[index];
+    bool changed = false;
+    // Blocks to scan: the original ones and the continuations split off
+    // them, but not the inlined bodies.
+    u32 capacity = fn->blocksCount + 8;
+    u32* work = malloc(sizeof(u32) * capacity);
+    u32 count = 0;
+    for (u32 bi = fn->blocksCount; bi-- > 0;) {
+        if (!fn->blocks[bi].dead) {
+            work[count++] = bi;
+        }
+    }
+    while (count > 0 && live_inst_count(fn) < INLINE_BUDGET) {
+        u32 bi = work[--count];
+        for (u32 i = 0; i < fn->blocks[bi].instsCount; i++) {
+            IrInst* inst = &fn->insts[fn->blocks[bi].insts[i]];
+            if (inst->op != IrCall || !should_inline(m, index, inst)) {
+                continue;
+            }
+            u32 cont = inline_call(m, index, bi, i);
+            if (count == capacity) {
+                capacity *= 2;
+                work = realloc(work, sizeof(u32) * capacity);
+            }
+            work[count++] = cont;
+            changed = true;
+            break;
+        }
+    }
+    free(work);
+    return changed;
+}
+
+// ---- Tail recursion ----
+
+// Parameter `p`, adding its instruction back to block 0 if DCE dropped it.
+static IrValue param_value(IrModule* m, IrFunction* fn, u32 p) {
+    for (u32 i = 0; i < fn->blocks[0].instsCount; i++) {
+        IrValue v = fn->blocks[0].insts[i];
+        if (fn->insts[v].op == IrParam && fn->insts[v].value.param == p) {
+            return v;
+        }
+    }
+    IrValue param = ir_new_inst(m, fn, (IrInst) { .op = IrParam, .value = { .param = p } });
+    ir_append(m, fn, 0, param);
+    return param;
+}
+
+// The loop header's phi for parameter `p`: the one whose value from block
+// 0 is the parameter. Value numbering removes it while every jump passes
+// the parameter unchanged, so it is recreated on demand and then replaces
+// the parameter everywhere else.
+static IrValue header_phi(IrModule* m, IrFunction* fn, u32 p) {
+    IrBlock* h = &fn->blocks[fn->loopHeader];
+    u32 entry = pred_index(h, 0);
+    for (u32 i = 0; i < h->instsCount && fn->insts[h->insts[i]].op == IrPhi; i++) {
+        const IrInst* incoming = &fn->insts[fn->operands[fn->insts[h->insts[i]].value.phi + entry]];
+        if (incoming->op == IrParam && incoming->value.param == p) {
+            return h->insts[i];
+        }
+    }
+    IrValue param = param_value(m, fn, p);
+    IrValue phi = ir_new_inst(m, fn, (IrInst) { .op = IrPhi });
+    replace_uses(fn, param, phi);
+    IrValue* operands = malloc(sizeof(IrValue) * h->predsCount);
+    for (u32 k = 0; k < h->predsCount; k++) {
+        operands[k] = param;
+    }
+    fn->insts[phi].value.phi = ir_push_operands(m, fn, operands, h->predsCount);
+    free(operands);
+    ir_append(m, fn, fn->loopHeader, phi);
+    h = &fn->blocks[fn->loopHeader];
+    memmove(h->insts + 1, h->insts, sizeof(IrValue) * (h->instsCount - 1));
+    h->insts[0] = phi;
+    return phi;
+}
+
+// The block that self tail calls jump back to, created on first use
+// between block 0 and the body.
+static u32 loop_header(IrModule* m, IrFunction* fn) {
+    if (fn->loopHeader != IR_NONE) {
+        return fn->loopHeader;
+    }
+    u32 header = ir_new_block(m, fn);
+    u32 body = fn->blocks[0].term.targets[0];
+    fn->blocks[header].term = (IrTerm) { .kind = IrJump, .value = IR_NONE, .targets = { body } };
+    replace_pred(fn, body, 0, header);
+    fn->blocks[0].term.targets[0] = header;
+    ir_add_pred(m, fn, header, 0);
+    fn->loopHeader = header;
+    return header;
+}
+
+// Turn self calls in tail position into jumps back to the loop header that
+// rebind the parameters through its phis.
+static bool eliminate_tail_recursion(IrModule* m, u32 index) {
+    IrFunction* fn = m->functions[index];
+    bool changed = false;
+
+    // A block that only returns a phi returns the incoming value from each
+    // predecessor; duplicate the return into predecessors whose incoming
+    // value is a self call they end with, exposing it as a tail call, or
+    // their own only phi, so the next block up is handled the same way.
+    for (u32 bi = 1; bi < fn->blocksCount; bi++) {
+        IrBlock* b = &fn->blocks[bi];
+        if (b->dead || b->term.kind != IrReturn || b->instsCount != 1 || b->insts[0] != b->term.value
+            || fn->insts[b->term.value].op != IrPhi) {
+            continue;
+        }
+        for (u32 k = b->predsCount; k-- > 0;) {
+            u32 pi = b->preds[k];
+            IrBlock* p = &fn->blocks[pi];
+            IrValue incoming = fn->operands[fn->insts[b->term.value].value.phi + k];
+            if (p->term.kind != IrJump || p->instsCount == 0 || p->insts[p->instsCount - 1] != incoming
+                || !(is_self_call(fn, index, incoming, fn->paramsCount)
+                    || (p->instsCount == 1 && fn->insts[incoming].op == IrPhi))) {
+                continue;
+            }
+            p->term = (IrTerm) { .kind = IrReturn, .value = incoming };
+            remove_pred(fn, bi, k);
+            changed = true;
+        }
+    }
+
+    IrValue* args = malloc(sizeof(IrValue) * (fn->paramsCount + 1));
+    IrValue* phis = malloc(sizeof(IrValue) * (fn->paramsCount + 1));
+    for (u32 bi = 1; bi < fn->blocksCount; bi++) {
+        IrBlock* b = &fn->blocks[bi];
+        if (b->dead || b->term.kind != IrReturn || b->instsCount == 0 || b->insts[b->instsCount - 1] != b->term.value
+            || !is_self_call(fn, index, b->term.value, fn->paramsCount)) {
+            continue;
+        }
+        IrValue call = b->term.value;
+        u32 header = loop_header(m, fn);
+        for (u32 p = 0; p < fn->paramsCount; p++) {
+            phis[p] = header_phi(m, fn, p);
+        }
+        // After header_phi, which may rewrite parameters in the arguments.
+        memcpy(args, fn->operands + fn->insts[call].value.call.first, sizeof(IrValue) * fn->paramsCount);
+        b = &fn->blocks[bi];
+        b->instsCount--;
+        b->term = (IrTerm) { .kind = IrJump, .value = IR_NONE, .targets = { header } };
+        ir_add_pred(m, fn, header, bi);
+        u32 predsCount = fn->blocks[header].predsCount;
+        for (u32 p = 0; p < fn->paramsCount; p++) {
+            IrInst* phi = &fn->insts[phis[p]];
+            IrValue* old = fn->operands + phi->value.phi;
+            u32 first = ir_push_operands(m, fn, old, predsCount - 1);
+            ir_push_operands(m, fn, &args[p], 1);
+            fn->insts[phis[p]].value.phi = first;
+        }
+        changed = true;
+    }
+    free(phis);
+    free(args);
+    return changed;
+}
+
+// ---- Pass manager ----
+
+static const IrPass irPipeline[] = {
+    { "inline", inline_calls },
+    { "simplify-cfg", simplify_cfg },
+    { "gvn", value_numbering },
+    { "tail-recursion", eliminate_tail_recursion },
+    { "simplify-cfg", simplify_cfg },
+    { "dce", eliminate_dead_code },
+};
+
+// Run the pipeline over function `index` until it stops changing.
+void ir_optimize(IrModule* m, u32 index) {
+    for (int round = 0; round < OPTIMIZE_ROUNDS; round++) {
+        bool changed = false;
+        for (usize i = 0; i < sizeof(irPipeline) / sizeof(irPipeline[0]); i++) {
+            changed |= irPipeline[i].run(m, index);
+        }
+        if (!changed) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,187 @@
+#include "profile.h"
+#include "eval.h"
+#include "ir.h"
+#include "lines.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// The profiler the SIGPROF handler records into.
+static Profiler* volatile activeProfiler;
+
+void profiler_init(Profiler* p, u32 hz) {
+    memset(p, 0, sizeof(*p));
+    for (u32 d = 0; d <= PROFILE_MAX_DEPTH + 1; d++) {
+        p->frames[d] = PROFILE_FRAME_NONE;
+    }
+    p->hz = hz ? hz : PROFILE_DEFAULT_HZ;
+    p->stacks = calloc(PROFILE_STACKS_CAPACITY, sizeof(ProfileStack));
+    p->pool = malloc(sizeof(u32) * PROFILE_POOL_CAPACITY);
+}
+
+void profiler_free(Profiler* p) {
+    free(p->stacks);
+    free(p->pool);
+    p->stacks = NULL;
+    p->pool = NULL;
+}
+
+// ---- Sampling ----
+
+static u64 hash_stack(const volatile u32* frames, u32 depth, bool truncated, usize root) {
+    u64 hash = 14695981039346656037ull ^ root;
+    for (u32 i = 0; i < depth; i++) {
+        hash = (hash ^ frames[i]) * 1099511628211ull;
+    }
+    hash = (hash ^ truncated) * 1099511628211ull;
+    return hash | 1; // 0 marks an empty entry
+}
+
+static bool same_stack(const Profiler* p, const ProfileStack* stack, u32 depth, bool truncated, usize root) {
+    if (stack->depth != depth + truncated || stack->root != root) {
+        return false;
+    }
+    for (u32 i = 0; i < depth; i++) {
+        if (p->pool[stack->first + i] != p->frames[i]) {
+            return false;
+        }
+    }
+    return !truncated || p->pool[stack->first + depth] == PROFILE_FRAME_TRUNCATED;
+}
+
+// The depth of the first free frame, for the paths that are not passed
+// one; PROFILE_MAX_DEPTH + 1 past that.
+u32 profiler_depth(const Profiler* p) {
+    u32 depth = 0;
+    while (depth <= PROFILE_MAX_DEPTH && p->frames[depth] != PROFILE_FRAME_NONE) {
+        depth++;
+    }
+    return depth;
+}
+
+// Runs in the signal handler: no allocation, no locks, no stdio.
+static void record_sample(Profiler* p) {
+    u32 depth = 0;
+    while (depth < PROFILE_MAX_DEPTH && p->frames[depth] != PROFILE_FRAME_NONE) {
+        depth++;
+    }
+    bool truncated = depth == PROFILE_MAX_DEPTH && p->frames[PROFILE_MAX_DEPTH] != PROFILE_FRAME_NONE;
+    usize root = depth ? p->root : 0;
+    u64 hash = hash_stack(p->frames, depth, truncated, root);
+    p->samples++;
+
+    u32 i = hash & (PROFILE_STACKS_CAPACITY - 1);
+    while (p->stacks[i].hash) {
+        ProfileStack* stack = &p->stacks[i];
+        if (stack->hash == hash && same_stack(p, stack, depth, truncated, root)) {
+            stack->count++;
+            return;
+        }
+        i = (i + 1) & (PROFILE_STACKS_CAPACITY - 1);
+    }
+    if ((p->stacksCount + 1) * 2 > PROFILE_STACKS_CAPACITY || p->poolCount + depth + 1 > PROFILE_POOL_CAPACITY) {
+        p->dropped++;
+        return;
+    }
+    ProfileStack* stack = &p->stacks[i];
+    *stack = (ProfileStack) { .hash = hash, .count = 1, .root = root, .first = p->poolCount, .depth = depth + truncated };
+    for (u32 f = 0; f < depth; f++) {
+        p->pool[p->poolCount++] = p->frames[f];
+    }
+    if (truncated) {
+        p->pool[p->poolCount++] = PROFILE_FRAME_TRUNCATED;
+    }
+    p->stacksCount++;
+}
+
+static void on_sigprof(int sig) {
+    (void)sig;
+    Profiler* p = activeProfiler;
+    if (p) {
+        record_sample(p);
+    }
+}
+
+// Sample CPU time at p->hz until profiler_stop().
+bool profiler_start(Profiler* p) {
+    struct sigaction action = { 0 };
+    action.sa_handler = on_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    activeProfiler = p;
+    if (sigaction(SIGPROF, &action, NULL) < 0) {
+        perror("sigaction");
+        activeProfiler = NULL;
+        return false;
+    }
+    struct itimerval timer = { 0 };
+    timer.it_interval.tv_usec = p->hz >= 1000000 ? 1 : 1000000 / p->hz;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+        perror("setitimer");
+        activeProfiler = NULL;
+        return false;
+    }
+    return true;
+}
+
+void profiler_stop(Profiler* p) {
+    struct itimerval timer = { 0 };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    if (activeProfiler == p) {
+        activeProfiler = NULL;
+    }
+}
+
+// ---- Report ----
+
+static void write_location(FILE* out, const char* filename, const LineIndex* lines, usize offset) {
+    usize line, column;
+    line_index_locate(lines, offset, &line, &column);
+    fprintf(out, " (%s:%zu)", filename, line);
+}
+
+static void write_frame(FILE* out, const Evaluator* ev, u32 frame, const char* filename, const LineIndex* lines) {
+    fputc(';', out);
+    if (frame == PROFILE_FRAME_COMPILE) {
+        fputs("[compile]", out);
+    } else if (frame == PROFILE_FRAME_TRUNCATED) {
+        fputs("[truncated]", out);
+    } else {
+        const IrFunction* fn = ev->module.functions[frame];
+        fputs(fn->name, out);
+        if (fn->defined) {
+            write_location(out, filename, lines, fn->ast->start);
+        }
+    }
+}
+
+// Write the samples as collapsed stacks, one `root;...;leaf count` line per
+// distinct stack, the input of flamegraph.pl, inferno and speedscope.
+// Frames are `name (file:line)` of the definition that ran. The root is
+// the top-level expression, which stays in place when it tail calls.
+void profiler_write(FILE* out, const Profiler* p, const Evaluator* ev, const char* filename, const LineIndex* lines) {
+    for (u32 i = 0; i < PROFILE_STACKS_CAPACITY; i++) {
+        const ProfileStack* stack = &p->stacks[i];
+        if (!stack->hash) {
+            continue;
+        }
+        if (stack->depth == 0) {
+            // Between calls: definitions and evaluator bookkeeping.
+            fputs("[evaluator]", out);
+        } else {
+            fputs("<top-level>", out);
+            write_location(out, filename, lines, stack->root);
+        }
+        for (u32 f = 0; f < stack->depth; f++) {
+            u32 frame = p->pool[stack->first + f];
+            if (frame != ev->anonymous) {
+                write_frame(out, ev, frame, filename, lines);
+            }
+        }
+        fprintf(out, " %llu\n", (unsigned long long)stack->count);
+    }
+}
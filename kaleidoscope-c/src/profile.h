@@ -0,0 +1,76 @@
+#pragma once
+
+#include "eval.h"
+#include "lines.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+#define PROFILE_DEFAULT_HZ 1000
+// Frames kept per sample, from the root; deeper ones are cut off.
+#define PROFILE_MAX_DEPTH 1024
+// Distinct stacks and their frames, preallocated because the signal
+// handler cannot allocate. Samples that do not fit are counted as dropped.
+#define PROFILE_STACKS_CAPACITY (1 << 15)
+#define PROFILE_POOL_CAPACITY (1 << 21)
+
+// Pseudo-frames, past any function index.
+#define PROFILE_FRAME_NONE ((u32)-1) // past the innermost frame
+#define PROFILE_FRAME_COMPILE ((u32)-2) // lowering and compiling on first call
+#define PROFILE_FRAME_TRUNCATED ((u32)-3) // frames past PROFILE_MAX_DEPTH
+
+typedef struct {
+    u64 hash;
+    u64 count;
+    usize root; // offset of the top-level expression the stack ran under
+    u32 first; // frames in Profiler.pool, root first
+    u32 depth;
+} ProfileStack;
+
+// Sampling profiler for the evaluator. The evaluator keeps a shadow stack
+// of function indices in `frames`; a SIGPROF timer samples it and counts
+// each distinct stack. Names and source positions are only resolved when
+// the report is written.
+//
+// frames[d] is the function running at depth d, and PROFILE_FRAME_NONE
+// past the innermost one. The interpreter passes depths down its calls, so
+// a call stores its frame on the way in and clears it on the way out, and
+// keeps no stack pointer. Depths stop at PROFILE_MAX_DEPTH + 1, a slot all
+// deeper frames share and samples do not read: frames[PROFILE_MAX_DEPTH]
+// is set exactly while some are cut off. `nativeDepth` is the depth of the
+// innermost call into machine code, which calls back into the evaluator
+// without passing depths.
+typedef struct Profiler {
+    volatile u32 frames[PROFILE_MAX_DEPTH + 2];
+    u32 nativeDepth;
+    volatile usize root;
+    u32 hz;
+    ProfileStack* stacks; // open addressing, keyed by hash
+    u32 stacksCount;
+    u32* pool;
+    u32 poolCount;
+    u64 samples;
+    u64 dropped;
+} Profiler;
+
+void profiler_init(Profiler* p, u32 hz);
+void profiler_free(Profiler* p);
+bool profiler_start(Profiler* p);
+void profiler_stop(Profiler* p);
+u32 profiler_depth(const Profiler* p);
+
+// The depth of a call made at `depth`.
+static inline u32 profiler_callee_depth(u32 depth) {
+    return depth + (depth <= PROFILE_MAX_DEPTH);
+}
+
+// Enter `function` at `depth`; for a tail call, it replaces the frame.
+static inline void profiler_enter(Profiler* p, u32 depth, u32 function) {
+    p->frames[depth] = function;
+}
+
+static inline void profiler_leave(Profiler* p, u32 depth) {
+    p->frames[depth] = PROFILE_FRAME_NONE;
+}
+
+void profiler_write(FILE* out, const Profiler* p, const Evaluator* ev, const char* filename, const LineIndex* lines);
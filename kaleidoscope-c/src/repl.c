@@ -0,0 +1,124 @@
+#include "arena.h"
+#include "eval.h"
+#include "lexer.h"
+#include "parser.h"
+#include "stats.h"
+#include "types.h"
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// ---- Latency histogram ----
+
+// Log-linear buckets: 8 sub-buckets per power of two, so any percentile is
+// reported within 12.5% in constant memory, however long the session runs.
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    u64 counts[LATENCY_BUCKETS];
+    u64 total;
+} LatencyHistogram;
+
+static usize latency_bucket(u64 ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    usize sub = (ns >> (msb - 3)) & (LATENCY_SUB_BUCKETS - 1);
+    return (msb - 2) * LATENCY_SUB_BUCKETS + sub;
+}
+
+// Upper bound of the values that land in `bucket`.
+static u64 latency_bucket_limit(usize bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    int msb = bucket / LATENCY_SUB_BUCKETS + 2;
+    u64 sub = bucket % LATENCY_SUB_BUCKETS;
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+}
+
+static void latency_record(LatencyHistogram* h, u64 ns) {
+    h->counts[latency_bucket(ns)]++;
+    h->total++;
+}
+
+static u64 latency_percentile(const LatencyHistogram* h, double p) {
+    u64 rank = (u64)(p * h->total);
+    u64 seen = 0;
+    for (usize i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank) {
+            return latency_bucket_limit(i);
+        }
+    }
+    return 0;
+}
+
+// ---- REPL ----
+
+typedef struct {
+    int fd;
+    u64 waitNs; // blocked in read(2), waiting for the user
+} ReplInput;
+
+// read(2) returns as soon as any input is available, unlike fread(), so a
+// statement is handled as soon as its terminating `;` arrives. Interrupted
+// reads are retried rather than taken as EOF.
+static usize read_fd_chunk(void* ctx, char* buf, usize cap) {
+    ReplInput* input = ctx;
+    u64 start = now_ns();
+    ssize_t n;
+    do {
+        n = read(input->fd, buf, cap);
+    } while (n < 0 && errno == EINTR);
+    input->waitNs += now_ns() - start;
+    return n > 0 ? (usize)n : 0;
+}
+
+// Read `;`-terminated statements from `fd` and evaluate each one as soon as
+// it is complete. Parse scratch lives in an arena reset after every
+// statement; definitions are copied into the evaluator. A statement's
+// latency covers lexing, parsing and evaluating it, less the time spent
+// waiting for its input.
+int run_repl(int fd) {
+    static Lexer lexer;
+    ReplInput input = { .fd = fd };
+    lexer_init(&lexer, read_fd_chunk, &input);
+    Evaluator ev;
+    evaluator_init(&ev);
+    Arena scratch = { 0 };
+    LatencyHistogram latency = { 0 };
+
+    while (true) {
+        u64 start = now_ns();
+        u64 waitNs = input.waitNs;
+        usize tokensCount;
+        Token* tokens = lexer_next_item(&lexer, &scratch, &tokensCount);
+        if (!tokens) {
+            break;
+        }
+        usize itemsCount;
+        Diagnostics diags = { .recover = true };
+        ItemAST* items = parse_program(&scratch, tokens, &itemsCount, &diags);
+        // Input is streamed, so errors are located by byte offset.
+        diagnostics_print(stderr, "<stdin>", &diags);
+        eval_items(&ev, items, itemsCount);
+        fflush(stdout);
+        arena_reset(&scratch);
+        latency_record(&latency, now_ns() - start - (input.waitNs - waitNs));
+    }
+
+    if (latency.total > 0) {
+        fprintf(stderr, "statements: %llu, p50: %.3f us, p99: %.3f us\n",
+            (unsigned long long)latency.total,
+            latency_percentile(&latency, 0.50) / 1000.0,
+            latency_percentile(&latency, 0.99) / 1000.0);
+    }
+
+    arena_free(&scratch);
+    evaluator_free(&ev);
+    lexer_free(&lexer);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "stats.h"
+#include "arena.h"
+#include "lexer.h"
+#include "parser.h"
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+u64 stats_begin(const Stats* stats) {
+    return stats->enabled ? now_ns() : 0;
+}
+
+void stats_end(Stats* stats, Phase phase, u64 start) {
+    if (stats->enabled) {
+        stats->phaseNs[phase] += now_ns() - start;
+        stats->ran[phase] = true;
+    }
+}
+
+void stats_count_tokens(Stats* stats, const Token* tokens) {
+    if (!stats->enabled) {
+        return;
+    }
+    for (usize i = 0; tokens[i].kind != TokEof; i++) {
+        stats->tokensByKind[tokens[i].kind]++;
+        stats->tokens++;
+    }
+}
+
+static u64 count_expr_nodes(const ExprAST* expr) {
+    switch (expr->type) {
+    case ExprBinopType:
+        return 1 + count_expr_nodes(expr->value.binop.lhs) + count_expr_nodes(expr->value.binop.rhs);
+    case ExprCallType: {
+        u64 count = 1;
+        for (usize i = 0; i < expr->value.call.argsCount; i++) {
+            count += count_expr_nodes(expr->value.call.args[i]);
+        }
+        return count;
+    }
+    case ExprIfType:
+        return 1 + count_expr_nodes(expr->value.conditional.cond)
+            + count_expr_nodes(expr->value.conditional.then)
+            + count_expr_nodes(expr->value.conditional.otherwise);
+    default:
+        return 1;
+    }
+}
+
+void stats_count_items(Stats* stats, const ItemAST* items, usize itemsCount) {
+    if (!stats->enabled) {
+        return;
+    }
+    stats->items += itemsCount;
+    for (usize i = 0; i < itemsCount; i++) {
+        if (items[i].fn.body) {
+            stats->astNodes += count_expr_nodes(items[i].fn.body);
+        }
+    }
+}
+
+void stats_count_arena(Stats* stats, const Arena* arena) {
+    if (!stats->enabled) {
+        return;
+    }
+    for (const Region* r = arena->begin; r != NULL; r = r->next) {
+        stats->arenaUsedBytes += r->count * sizeof(uintptr_t);
+        stats->arenaReservedBytes += r->capacity * sizeof(uintptr_t);
+    }
+}
+
+static const char* phaseNames[PhaseCount] = { "load", "lex", "parse", "eval", "dump" };
+static const char* tokenKindNames[TOKEN_KIND_COUNT] = {
+    "eof", "def", "extern", "if", "then", "else", "identifier", "number", "other"
+};
+
+static void print_throughput(FILE* out, const Stats* stats, Phase phase, bool* first) {
+    if (!stats->ran[phase] || stats->phaseNs[phase] == 0) {
+        return;
+    }
+    double seconds = stats->phaseNs[phase] / 1e9;
+    fprintf(out, "%s\n    \"%s\": { \"mb_per_s\": %.3f, \"tokens_per_s\": %.0f }",
+        *first ? "" : ",", phaseNames[phase],
+        stats->bytes / 1e6 / seconds, stats->tokens / seconds);
+    *first = false;
+}
+
+static void print_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+void stats_print_json(FILE* out, const Stats* stats) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "{\n  \"file\": ");
+    print_json_string(out, stats->filename);
+    fprintf(out, ",\n  \"bytes\": %llu,\n  \"phases_ns\": {", (unsigned long long)stats->bytes);
+    bool first = true;
+    for (usize i = 0; i < PhaseCount; i++) {
+        if (stats->ran[i]) {
+            fprintf(out, "%s \"%s\": %llu", first ? "" : ",", phaseNames[i], (unsigned long long)stats->phaseNs[i]);
+            first = false;
+        }
+    }
+    fprintf(out, " },\n  \"tokens\": %llu,\n  \"tokens_by_kind\": {", (unsigned long long)stats->tokens);
+    first = true;
+    for (usize i = 0; i < TOKEN_KIND_COUNT; i++) {
+        if (stats->tokensByKind[i]) {
+            fprintf(out, "%s \"%s\": %llu", first ? "" : ",", tokenKindNames[i], (unsigned long long)stats->tokensByKind[i]);
+            first = false;
+        }
+    }
+    fprintf(out, " },\n  \"items\": %llu,\n  \"ast_nodes\": %llu,\n", (unsigned long long)stats->items, (unsigned long long)stats->astNodes);
+    fprintf(out, "  \"arena_used_bytes\": %llu,\n  \"arena_reserved_bytes\": %llu,\n",
+        (unsigned long long)stats->arenaUsedBytes, (unsigned long long)stats->arenaReservedBytes);
+    fprintf(out, "  \"peak_rss_bytes\": %llu,\n  \"throughput\": {", (unsigned long long)usage.ru_maxrss * 1024);
+    first = true;
+    print_throughput(out, stats, PhaseLex, &first);
+    print_throughput(out, stats, PhaseParse, &first);
+    fprintf(out, "\n  }\n}\n");
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "arena.h"
+#include "lexer.h"
+#include "parser.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef enum {
+    PhaseLoad,
+    PhaseLex,
+    PhaseParse,
+    PhaseEval,
+    PhaseDump,
+    PhaseCount
+} Phase;
+
+#define TOKEN_KIND_COUNT (TokOther + 1)
+
+// Per-run counters for `--stats`. Everything is gated on `enabled`, so a
+// run without `--stats` only pays a branch per phase.
+typedef struct {
+    bool enabled;
+    const char* filename;
+    bool ran[PhaseCount];
+    u64 phaseNs[PhaseCount];
+    u64 bytes;
+    u64 tokens;
+    u64 tokensByKind[TOKEN_KIND_COUNT];
+    u64 items;
+    u64 astNodes;
+    u64 arenaUsedBytes;
+    u64 arenaReservedBytes;
+} Stats;
+
+u64 now_ns(void);
+u64 stats_begin(const Stats* stats);
+void stats_end(Stats* stats, Phase phase, u64 start);
+void stats_count_tokens(Stats* stats, const Token* tokens);
+void stats_count_items(Stats* stats, const ItemAST* items, usize itemsCount);
+void stats_count_arena(Stats* stats, const Arena* arena);
+void stats_print_json(FILE* out, const Stats* stats);
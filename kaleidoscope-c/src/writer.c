@@ -0,0 +1,84 @@
+#include "writer.h"
+#include "lexer.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Longest "%f" rendering of a double: 309 integer digits, sign, point and
+// six decimals.
+#define MAX_DOUBLE_CHARS 320
+
+void writer_init(Writer* w, int fd) {
+    w->fd = fd;
+    w->len = 0;
+    w->buf = malloc(WRITER_CAPACITY);
+}
+
+void writer_free(Writer* w) {
+    writer_flush(w);
+    free(w->buf);
+    w->buf = NULL;
+}
+
+static void write_all(int fd, const char* data, usize size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+void writer_flush(Writer* w) {
+    write_all(w->fd, w->buf, w->len);
+    w->len = 0;
+}
+
+static void writer_reserve(Writer* w, usize n) {
+    if (WRITER_CAPACITY - w->len < n) {
+        writer_flush(w);
+    }
+}
+
+void writer_char(Writer* w, char c) {
+    writer_reserve(w, 1);
+    w->buf[w->len++] = c;
+}
+
+void writer_str(Writer* w, const char* str) {
+    usize length = strlen(str);
+    if (length > WRITER_CAPACITY) {
+        writer_flush(w);
+        write_all(w->fd, str, length);
+        return;
+    }
+    writer_reserve(w, length);
+    memcpy(w->buf + w->len, str, length);
+    w->len += length;
+}
+
+// Same text as token_to_string(), formatted in place.
+void writer_token(Writer* w, Token token) {
+    switch (token.kind) {
+    case TokIdentifier:
+        writer_str(w, token.value.identifier);
+        break;
+    case TokNumber:
+        writer_reserve(w, MAX_DOUBLE_CHARS);
+        w->len += snprintf(w->buf + w->len, MAX_DOUBLE_CHARS, "%f", token.value.number);
+        break;
+    case TokOther:
+        writer_char(w, token.value.other);
+        break;
+    default:
+        writer_str(w, token_to_string(NULL, token));
+        break;
+    }
+}
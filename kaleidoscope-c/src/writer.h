@@ -0,0 +1,21 @@
+#pragma once
+
+#include "lexer.h"
+#include "types.h"
+
+#define WRITER_CAPACITY (1 << 20)
+
+// Formats output into one reusable buffer and flushes it with large
+// write(2) calls. Don't interleave with stdio on the same descriptor.
+typedef struct {
+    int fd;
+    usize len;
+    char* buf;
+} Writer;
+
+void writer_init(Writer* w, int fd);
+void writer_free(Writer* w);
+void writer_flush(Writer* w);
+void writer_str(Writer* w, const char* str);
+void writer_char(Writer* w, char c);
+void writer_token(Writer* w, Token token);
@@ -0,0 +1,97 @@
+// Stress a ConcurrentArena from several threads: mixed allocation sizes,
+// reservations and rewinds to snapshots and between jobs of growing size,
+// and resets of the whole family. Every allocation is filled with a
+// pattern of its own and checked before it is dropped, so overlapping
+// allocations are caught; run it under -fsanitize=thread and
+// -fsanitize=address to catch races and leaks.
+#define ARENA_IMPLEMENTATION
+#include "../src/arena.h"
+#include "../src/carena.c"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 8
+#define CYCLES 3
+#define ROUNDS 100
+#define ALLOCS 256
+
+static ConcurrentArena family;
+
+typedef struct {
+    unsigned char* data;
+    usize size;
+    unsigned char fill;
+} Allocation;
+
+static bool check(const Allocation* allocs, usize count) {
+    for (usize i = 0; i < count; i++) {
+        const unsigned char* data = allocs[i].data;
+        if (data[0] != allocs[i].fill || memcmp(data, data + 1, allocs[i].size - 1) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void* work(void* arg) {
+    long id = (long)arg;
+    ArenaThread* t = carena_thread(&family);
+    static _Thread_local Allocation allocs[ALLOCS];
+    for (usize round = 0; round < ROUNDS; round++) {
+        ArenaSnapshot snapshot = carena_snapshot(t);
+        if (round % 2 == 0) {
+            carena_reserve(t, 50000 + round * 2048);
+        }
+        for (usize i = 0; i < ALLOCS; i++) {
+            usize size = (i * 37 + id) % 700 + 1;
+            if (i % 97 == 0) {
+                // Oversized, and growing from round to round like the jobs
+                // of a batch listed smallest first.
+                size = 70000 + round * 1024;
+            }
+            // Half the allocations go through arena.h, as lex() and
+            // parse_program() do.
+            unsigned char* data = i % 2 ? carena_alloc(t, size) : arena_alloc(&t->arena, size);
+            allocs[i] = (Allocation) { data, size, (unsigned char)(id * 31 + round + i) };
+            memset(data, allocs[i].fill, size);
+        }
+        if (!check(allocs, ALLOCS)) {
+            fprintf(stderr, "thread %ld, round %zu: allocations overlap\n", id, round);
+            abort();
+        }
+        if (round % 3) {
+            carena_rewind(t, round % 3 == 1 ? snapshot : (ArenaSnapshot) { 0 });
+        }
+    }
+    // What a thread keeps after a rewind is bounded by what it dropped,
+    // not by everything it ever allocated.
+    carena_rewind(t, (ArenaSnapshot) { 0 });
+    usize words = 0;
+    for (Region* r = t->arena.begin; r; r = r->next) {
+        words += r->capacity;
+    }
+    if (words * sizeof(uintptr_t) > 8 * 1024 * 1024) {
+        fprintf(stderr, "thread %ld: %zu bytes kept after a rewind\n", id, words * sizeof(uintptr_t));
+        abort();
+    }
+    return NULL;
+}
+
+int main(void) {
+    carena_init(&family);
+    for (int cycle = 0; cycle < CYCLES; cycle++) {
+        pthread_t threads[THREADS];
+        for (long i = 0; i < THREADS; i++) {
+            pthread_create(&threads[i], NULL, work, (void*)i);
+        }
+        for (int i = 0; i < THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        carena_reset(&family);
+    }
+    printf("carena: %d threads x %d cycles, %zu regions pooled\n", THREADS, CYCLES, atomic_load(&family.poolCount));
+    carena_free(&family);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "types.h"
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+// Bump allocator for everything one compilation allocates: tokens, nodes
+// and items. reset() drops it all at once. The arena keeps one block sized
+// to the largest compilation seen so far, so repeated compilations of
+// similar inputs stop calling malloc entirely.
+class CompilationArena {
+public:
+    explicit CompilationArena(usize initialBytes = 1 << 20)
+        : blockBytes(initialBytes)
+        , block(std::make_unique_for_overwrite<std::byte[]>(initialBytes)) {
+        mono.emplace(block.get(), blockBytes, &overflow);
+    }
+
+    CompilationArena(const CompilationArena&) = delete;
+    CompilationArena& operator=(const CompilationArena&) = delete;
+
+    std::pmr::memory_resource* resource() {
+        return &*mono;
+    }
+
+    // Bytes reserved by the arena, including overflow chunks.
+    usize reserved_bytes() const {
+        return blockBytes + overflow.bytes;
+    }
+
+    // Release the compilation. Everything allocated from resource() is
+    // invalidated.
+    void reset() {
+        mono.reset();
+        if (overflow.bytes > 0) {
+            blockBytes += overflow.bytes;
+            block.reset();
+            overflow.release();
+            block = std::make_unique_for_overwrite<std::byte[]>(blockBytes);
+        }
+        mono.emplace(block.get(), blockBytes, &overflow);
+    }
+
+private:
+    // Upstream for allocations that don't fit the block; tracks their size
+    // so the next reset() can grow the block to cover them.
+    struct Overflow : std::pmr::memory_resource {
+        usize bytes = 0;
+
+        void release() {
+            bytes = 0;
+        }
+
+    private:
+        void* do_allocate(usize size, usize align) override {
+            bytes += size;
+            return std::pmr::new_delete_resource()->allocate(size, align);
+        }
+
+        void do_deallocate(void* ptr, usize size, usize align) override {
+            std::pmr::new_delete_resource()->deallocate(ptr, size, align);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    usize blockBytes;
+    std::unique_ptr<std::byte[]> block;
+    Overflow overflow;
+    std::optional<std::pmr::monotonic_buffer_resource> mono;
+};
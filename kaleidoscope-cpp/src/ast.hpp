@@ -1,11 +1,21 @@
 #pragma once
 
 #include "types.h"
+#include <memory_resource>
 #include <vector>
 
+// Marks an absent child (leaf nodes, the end of an argument list).
+constexpr usize NoExpr = usize(-1);
+
+// A node of the flat AST. `token` indexes the token stream and `lhs`/`rhs`
+// index the node array:
+// - Number, Variable: leaves, `token` is the literal/name.
+// - Binop: `token` is the operator.
+// - Call: `token` is the callee, `lhs` is the first Arg node.
+// - Arg: `lhs` is the argument expression, `rhs` is the next Arg node.
 struct Expr {
     enum class Tag {
-        Number, Variable, Binop, Call
+        Number, Variable, Binop, Call, Arg
     };
     Tag tag;
     usize token;
@@ -18,6 +28,37 @@ struct ExprAST {
     usize root;
 };
 
+// A top-level `def`, `extern` or bare expression. Items own the contiguous
+// token range [tokBegin, tokEnd) and node range [exprBegin, exprEnd).
+struct Item {
+    enum class Tag {
+        Def, Extern, Expr
+    };
+    Tag tag;
+    usize tokBegin;
+    usize tokEnd;
+    // Token of the prototype name; the parameter names are the
+    // `paramCount` tokens following its open paren.
+    usize proto;
+    usize paramCount;
+    usize exprBegin;
+    usize exprEnd;
+    usize body;
+};
+
+// All storage comes from one memory resource, typically a CompilationArena.
+struct Program {
+    explicit Program(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : exprs(resource)
+        , items(resource) { }
+
+    std::pmr::vector<Expr> exprs;
+    std::pmr::vector<Item> items;
+    // Set when parsing stopped early; `items` holds everything before it.
+    const char* error = nullptr;
+    usize errorToken = 0;
+};
+
 // typedef enum {
 //     ExprNumberType,
 //     ExprVariableType,
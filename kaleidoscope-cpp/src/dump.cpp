@@ -0,0 +1,120 @@
+#include "ast.hpp"
+#include "emitter.hpp"
+#include "token.hpp"
+#include <span>
+#include <string_view>
+
+// ---- Text ----
+
+void dump_tokens_text(Emitter& out, std::span<const Token> tokens) {
+    for (const Token& tok : tokens) {
+        out.put('{');
+        out.put(Token::tag_name(tok.tag));
+        out.put(',');
+        out.put_uint(tok.start);
+        out.put("},");
+    }
+    out.put('\n');
+}
+
+static void dump_expr_text(Emitter& out, std::string_view src, std::span<const Token> tokens,
+    std::span<const Expr> exprs, usize node) {
+    const Expr& e = exprs[node];
+    switch (e.tag) {
+    case Expr::Tag::Number:
+    case Expr::Tag::Variable:
+        out.put(token_text(src, tokens[e.token]));
+        break;
+    case Expr::Tag::Binop:
+        out.put('(');
+        out.put(src[tokens[e.token].start]);
+        out.put(' ');
+        dump_expr_text(out, src, tokens, exprs, e.lhs);
+        out.put(' ');
+        dump_expr_text(out, src, tokens, exprs, e.rhs);
+        out.put(')');
+        break;
+    case Expr::Tag::Call:
+        out.put("(call ");
+        out.put(token_text(src, tokens[e.token]));
+        for (usize arg = e.lhs; arg != NoExpr; arg = exprs[arg].rhs) {
+            out.put(' ');
+            dump_expr_text(out, src, tokens, exprs, exprs[arg].lhs);
+        }
+        out.put(')');
+        break;
+    case Expr::Tag::Arg:
+        break;
+    }
+}
+
+// One S-expression per top-level item.
+void dump_program_text(Emitter& out, std::string_view src, std::span<const Token> tokens, const Program& program) {
+    for (const Item& item : program.items) {
+        if (item.tag != Item::Tag::Expr) {
+            out.put(item.tag == Item::Tag::Def ? "(def " : "(extern ");
+            out.put(token_text(src, tokens[item.proto]));
+            out.put(" (");
+            for (usize i = 0; i < item.paramCount; i++) {
+                if (i) {
+                    out.put(' ');
+                }
+                out.put(token_text(src, tokens[item.proto + 2 + i]));
+            }
+            out.put(')');
+        }
+        if (item.body != NoExpr) {
+            if (item.tag == Item::Tag::Def) {
+                out.put(' ');
+            }
+            dump_expr_text(out, src, tokens, program.exprs, item.body);
+        }
+        if (item.tag != Item::Tag::Expr) {
+            out.put(')');
+        }
+        out.put('\n');
+    }
+}
+
+// ---- Binary ----
+//
+// Both formats start with a 4-byte magic and a version byte, followed by
+// LEB128 varints. Node and token references are stored plus one so that
+// NoExpr encodes as 0.
+//
+// Tokens: "KTOK" 1 count { tag:u8 startDelta:varint }*
+// AST:    "KAST" 1 exprCount { tag:u8 token lhs rhs }*
+//                  itemCount { tag:u8 tokBegin tokEnd proto paramCount exprBegin exprEnd body }*
+
+void dump_tokens_binary(Emitter& out, std::span<const Token> tokens) {
+    out.put("KTOK\x01");
+    out.put_varint(tokens.size());
+    usize prev = 0;
+    for (const Token& tok : tokens) {
+        out.put(char(tok.tag));
+        out.put_varint(tok.start - prev);
+        prev = tok.start;
+    }
+}
+
+void dump_program_binary(Emitter& out, const Program& program) {
+    out.put("KAST\x01");
+    out.put_varint(program.exprs.size());
+    for (const Expr& e : program.exprs) {
+        out.put(char(e.tag));
+        out.put_varint(e.token + 1);
+        out.put_varint(e.lhs + 1);
+        out.put_varint(e.rhs + 1);
+    }
+    out.put_varint(program.items.size());
+    for (const Item& item : program.items) {
+        out.put(char(item.tag));
+        out.put_varint(item.tokBegin);
+        out.put_varint(item.tokEnd);
+        out.put_varint(item.proto + 1);
+        out.put_varint(item.paramCount);
+        out.put_varint(item.exprBegin);
+        out.put_varint(item.exprEnd);
+        out.put_varint(item.body + 1);
+    }
+}
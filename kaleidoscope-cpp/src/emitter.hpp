@@ -0,0 +1,81 @@
+#pragma once
+#include "types.h"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unistd.h>
+
+// Formats output into one reusable buffer and hands it to the kernel in
+// large write(2) calls, bypassing iostreams.
+struct Emitter {
+    static constexpr usize capacity = 1 << 20;
+
+    int fd;
+    usize len = 0;
+    std::unique_ptr<char[]> buf = std::make_unique<char[]>(capacity);
+
+    explicit Emitter(int fd) : fd(fd) { }
+    Emitter(const Emitter&) = delete;
+    Emitter& operator=(const Emitter&) = delete;
+    ~Emitter() { flush(); }
+
+    void flush() {
+        write_all(buf.get(), len);
+        len = 0;
+    }
+
+    // Make room for `n` more bytes; `n` must not exceed `capacity`.
+    void reserve(usize n) {
+        if (capacity - len < n) {
+            flush();
+        }
+    }
+
+    void put(char c) {
+        reserve(1);
+        buf[len++] = c;
+    }
+
+    void put(std::string_view s) {
+        if (s.size() > capacity) {
+            flush();
+            write_all(s.data(), s.size());
+            return;
+        }
+        reserve(s.size());
+        memcpy(buf.get() + len, s.data(), s.size());
+        len += s.size();
+    }
+
+    void put_uint(u64 value) {
+        reserve(20);
+        len = std::to_chars(buf.get() + len, buf.get() + capacity, value).ptr - buf.get();
+    }
+
+    // Unsigned LEB128, used by the binary dumps.
+    void put_varint(u64 value) {
+        reserve(10);
+        while (value >= 0x80) {
+            buf[len++] = char(value | 0x80);
+            value >>= 7;
+        }
+        buf[len++] = char(value);
+    }
+
+private:
+    void write_all(const char* data, usize size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += n;
+            size -= n;
+        }
+    }
+};
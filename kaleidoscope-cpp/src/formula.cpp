@@ -0,0 +1,106 @@
+#include "ast.hpp"
+#include "token.hpp"
+#include "types.h"
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <vector>
+
+// Kaleidoscope expressions lexed and parsed at compile time:
+//
+//   constexpr auto f = "a * x + b"_ks;
+//
+// yields a Formula whose tokens and nodes live in fixed-size arrays in the
+// binary's read-only data, with no runtime parsing or allocation. A formula
+// that doesn't parse fails to compile.
+
+template <usize N>
+struct FixedString {
+    char data[N];
+
+    consteval FixedString(const char (&str)[N]) {
+        std::copy_n(str, N, data);
+    }
+
+    constexpr std::string_view view() const {
+        return { data, N - 1 };
+    }
+};
+
+template <usize TokenCount, usize ExprCount>
+struct Formula {
+    std::string_view src;
+    std::array<Token, TokenCount> tokens;
+    std::array<Expr, ExprCount> exprs;
+    usize root;
+
+    constexpr std::string_view text(usize token) const {
+        return token_text(src, tokens[token]);
+    }
+};
+
+// Not constexpr: reaching one during constant evaluation is the compile
+// error. The diagnostic points here from the offending literal, and the
+// function's name is the parser's error message.
+inline void formula_error_unknown_token_when_expecting_expression() { }
+inline void formula_error_expected_right_paren() { }
+inline void formula_error_expected_comma_in_argument_list() { }
+inline void formula_error_unexpected_token_after_expression() { }
+inline void formula_error_other() { }
+
+constexpr void embedded_formula_parse_error(const char* error) {
+    const std::string_view msg = error ? error : "";
+    if (msg == "Unknown token when expecting expression") {
+        formula_error_unknown_token_when_expecting_expression();
+    }
+    if (msg == "Expected right paren") {
+        formula_error_expected_right_paren();
+    }
+    if (msg == "Expected comma in argument list") {
+        formula_error_expected_comma_in_argument_list();
+    }
+    if (msg == "Unexpected token after expression") {
+        formula_error_unexpected_token_after_expression();
+    }
+    if (error) {
+        formula_error_other();
+    }
+}
+
+struct FormulaSize {
+    usize tokens;
+    usize exprs;
+};
+
+template <FixedString S>
+consteval FormulaSize formula_size() {
+    std::vector<Token> tokens = lex(S.view());
+    ExprAST ast;
+    if (const char* error = parse_formula(tokens, ast)) {
+        embedded_formula_parse_error(error);
+    }
+    return { tokens.size(), ast.exprs.size() };
+}
+
+template <FixedString S>
+consteval auto operator""_ks() {
+    constexpr FormulaSize size = formula_size<S>();
+    std::vector<Token> tokens = lex(S.view());
+    ExprAST ast;
+    parse_formula(tokens, ast);
+
+    Formula<size.tokens, size.exprs> formula = {};
+    formula.src = S.view();
+    std::copy(tokens.begin(), tokens.end(), formula.tokens.begin());
+    std::copy(ast.exprs.begin(), ast.exprs.end(), formula.exprs.begin());
+    formula.root = ast.root;
+    return formula;
+}
+
+static_assert("x"_ks.tokens.size() == 2);
+static_assert("x"_ks.exprs[0].tag == Expr::Tag::Variable);
+static_assert("a * x + b"_ks.tokens.size() == 6);
+static_assert("a * x + b"_ks.exprs.size() == 5);
+static_assert("a * x + b"_ks.text("a * x + b"_ks.exprs["a * x + b"_ks.root].token) == "+");
+static_assert("f(x, 2)"_ks.exprs.size() == 5);
+static_assert("f(x, 2)"_ks.exprs["f(x, 2)"_ks.root].tag == Expr::Tag::Call);
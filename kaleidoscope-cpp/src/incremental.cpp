@@ -0,0 +1,379 @@
+#include "arena.hpp"
+#include "ast.hpp"
+#include "token.hpp"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ---- Segments ----
+
+// A run of the document that lexes and parses on its own: one top-level
+// item and the separators after it. Token starts are relative to `text`,
+// and the item and its nodes index `tokens` and `exprs`, so an edit
+// elsewhere never touches the segment.
+//
+// When an item fails to parse, its segment runs from the item to the
+// next point where the text lexes and parses as before, and holds the
+// error instead. Segments after it are kept up to date all the same, and
+// only become part of the program once the error is fixed.
+struct Segment {
+    std::string text;
+    std::vector<Token> tokens; // without Eof
+    std::vector<Expr> exprs;
+    Item item;
+    bool hasItem = false; // false for an error, or a document without items
+    const char* error = nullptr;
+    usize errorToken = 0; // tokens.size() for the token after the segment
+};
+
+// Segments are kept in blocks of about this many, so that an edit moves
+// at most a few blocks' worth of them and finding the segment at an offset
+// steps over blocks rather than segments.
+constexpr usize SegmentBlockSize = 64;
+
+struct SegmentBlock {
+    std::vector<Segment> segments;
+    usize bytes = 0;
+};
+
+// Windows up to this size are lexed and parsed in the document's scratch
+// arena, which then keeps a block large enough for any of them. Larger
+// ones, as after an edit that opens a parenthesis, use the heap.
+constexpr usize ScratchWindowBytes = 64 * 1024;
+
+// A source file kept lexed and parsed across edits.
+struct Document {
+    std::vector<SegmentBlock> blocks;
+    usize bytes = 0;
+    // Tokens and nodes of the window being parsed, released after each.
+    std::unique_ptr<CompilationArena> scratch = std::make_unique<CompilationArena>(256 * 1024);
+};
+
+// Replace `length` bytes at `start` with `text`.
+struct Edit {
+    usize start;
+    usize length;
+    std::string text;
+};
+
+struct EditStats {
+    usize tokensLexed;
+    usize itemsParsed;
+};
+
+// Where a segment is: its block, index in the block and byte offset.
+struct SegmentPos {
+    usize block;
+    usize index;
+    usize offset;
+};
+
+static const Segment& segment_at(const Document& doc, SegmentPos pos) {
+    return doc.blocks[pos.block].segments[pos.index];
+}
+
+// The segment that contains byte `offset`; the last one at the end.
+static SegmentPos locate(const Document& doc, usize offset) {
+    SegmentPos pos = { 0, 0, 0 };
+    while (pos.block + 1 < doc.blocks.size() && pos.offset + doc.blocks[pos.block].bytes <= offset) {
+        pos.offset += doc.blocks[pos.block].bytes;
+        pos.block++;
+    }
+    const std::vector<Segment>& segments = doc.blocks[pos.block].segments;
+    while (pos.index + 1 < segments.size() && pos.offset + segments[pos.index].text.size() <= offset) {
+        pos.offset += segments[pos.index].text.size();
+        pos.index++;
+    }
+    return pos;
+}
+
+// Step to the next or previous segment; false at either end.
+static bool next_segment(const Document& doc, SegmentPos& pos) {
+    SegmentPos next = { pos.block, pos.index + 1, pos.offset + segment_at(doc, pos).text.size() };
+    if (next.index == doc.blocks[pos.block].segments.size()) {
+        if (pos.block + 1 == doc.blocks.size()) {
+            return false;
+        }
+        next.block++;
+        next.index = 0;
+    }
+    pos = next;
+    return true;
+}
+
+static bool prev_segment(const Document& doc, SegmentPos& pos) {
+    if (pos.index == 0) {
+        if (pos.block == 0) {
+            return false;
+        }
+        pos.block--;
+        pos.index = doc.blocks[pos.block].segments.size();
+    }
+    pos.index--;
+    pos.offset -= segment_at(doc, pos).text.size();
+    return true;
+}
+
+// ---- Windows ----
+
+constexpr usize NoSync = usize(-1);
+
+// Where a segment begins in the tokens of a window.
+struct Piece {
+    usize tokBegin;
+    Item item;
+    bool hasItem;
+    const char* error;
+    usize errorToken;
+};
+
+// Lex and parse `text`, which begins where the top-level loop starts an
+// item, into segments. Unless `syncAt` is NoSync, the text is followed by
+// more of the document and it ends with one unchanged segment starting at
+// `syncAt`: parsing must reach that point between two items, where the rest
+// of the document parses as before. Returns false if it does not, and the
+// window has to grow.
+static bool parse_window(std::string_view text, usize syncAt, std::vector<Segment>& out, EditStats& stats,
+    std::pmr::memory_resource* resource) {
+    const std::pmr::vector<Token> tokens = lex(text, resource);
+    std::pmr::vector<Expr> exprs(resource);
+    exprs.reserve(tokens.size());
+    Parser<std::pmr::vector<Expr>> p = { tokens, exprs, 0, 0 };
+    std::vector<Piece> pieces;
+    usize endTok;
+    stats.tokensLexed += tokens.size() - 1;
+    while (true) {
+        if (syncAt != NoSync) {
+            while (tokens[p.idx].start < syncAt && peek(p) == Token::Tag::Semicolon) {
+                p.idx++;
+            }
+            // Eof lies past `syncAt`, so it is always caught here.
+            if (tokens[p.idx].start >= syncAt) {
+                if (tokens[p.idx].start != syncAt) {
+                    return false;
+                }
+                endTok = p.idx;
+                break;
+            }
+        } else {
+            skip_separators(p);
+            if (peek(p) == Token::Tag::Eof) {
+                endTok = p.idx;
+                break;
+            }
+        }
+        Item item;
+        const usize begin = p.idx;
+        if (parse_item(p, item)) {
+            pieces.push_back({ begin, item, true, nullptr, 0 });
+            continue;
+        }
+        endTok = tokens.size() - 1;
+        if (syncAt != NoSync) {
+            // The error must come from tokens that are the same in the whole
+            // document, up to and including the one at `syncAt`.
+            auto at = std::lower_bound(tokens.begin(), tokens.end(), syncAt,
+                [](const Token& t, usize pos) { return t.start < pos; });
+            if (tokens[p.errorToken].start > syncAt || at->start != syncAt) {
+                return false;
+            }
+            endTok = at - tokens.begin();
+        }
+        pieces.push_back({ begin, {}, false, p.error, p.errorToken });
+        break;
+    }
+
+    const usize endByte = syncAt != NoSync ? syncAt : text.size();
+    if (pieces.empty()) {
+        // Only separators, or nothing at all.
+        if (endByte > 0 || syncAt == NoSync) {
+            Segment& s = out.emplace_back();
+            s.text = text.substr(0, endByte);
+            s.tokens.assign(tokens.begin(), tokens.begin() + endTok);
+        }
+        return true;
+    }
+    // The first segment also holds any separators the window starts with.
+    pieces[0].tokBegin = 0;
+    for (usize k = 0; k < pieces.size(); k++) {
+        const Piece& piece = pieces[k];
+        const usize tokEnd = k + 1 < pieces.size() ? pieces[k + 1].tokBegin : endTok;
+        const usize byteBegin = k == 0 ? 0 : tokens[piece.tokBegin].start;
+        const usize byteEnd = k + 1 < pieces.size() ? tokens[tokEnd].start : endByte;
+        Segment& s = out.emplace_back();
+        s.text = text.substr(byteBegin, byteEnd - byteBegin);
+        s.tokens.assign(tokens.begin() + piece.tokBegin, tokens.begin() + tokEnd);
+        for (Token& tok : s.tokens) {
+            tok.start -= byteBegin;
+        }
+        if (piece.hasItem) {
+            s.item = piece.item;
+            s.hasItem = true;
+            s.exprs.assign(exprs.begin() + piece.item.exprBegin, exprs.begin() + piece.item.exprEnd);
+            rebase_item(s.item, s.exprs, -isize(piece.tokBegin), -isize(piece.item.exprBegin));
+            stats.itemsParsed++;
+        } else {
+            s.error = piece.error;
+            s.errorToken = piece.errorToken - piece.tokBegin;
+        }
+    }
+    return true;
+}
+
+static void update_bytes(SegmentBlock& block) {
+    block.bytes = 0;
+    for (const Segment& s : block.segments) {
+        block.bytes += s.text.size();
+    }
+}
+
+// Cut blocks that grew past twice their size back to SegmentBlockSize.
+static void split_block(Document& doc, usize b) {
+    while (doc.blocks[b].segments.size() > 2 * SegmentBlockSize) {
+        std::vector<Segment>& segments = doc.blocks[b].segments;
+        SegmentBlock tail;
+        tail.segments.assign(std::make_move_iterator(segments.end() - SegmentBlockSize), std::make_move_iterator(segments.end()));
+        segments.resize(segments.size() - SegmentBlockSize);
+        update_bytes(tail);
+        doc.blocks.insert(doc.blocks.begin() + b + 1, std::move(tail));
+        update_bytes(doc.blocks[b]);
+    }
+}
+
+// Replace the segments from `lo` up to `hi` (or to the end of the document
+// if `toEnd`) with `fresh`.
+static void replace_segments(Document& doc, SegmentPos lo, SegmentPos hi, bool toEnd, std::vector<Segment>& fresh) {
+    if (toEnd) {
+        hi = { doc.blocks.size() - 1, doc.blocks.back().segments.size(), doc.bytes };
+    }
+    std::vector<Segment>& segments = doc.blocks[lo.block].segments;
+    usize hiIndex = hi.index;
+    doc.bytes -= doc.blocks[lo.block].bytes;
+    if (hi.block > lo.block) {
+        for (usize b = lo.block + 1; b <= hi.block; b++) {
+            doc.bytes -= doc.blocks[b].bytes;
+            if (b == hi.block) {
+                hiIndex += segments.size();
+            }
+            std::vector<Segment>& from = doc.blocks[b].segments;
+            segments.insert(segments.end(), std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+        }
+        doc.blocks.erase(doc.blocks.begin() + lo.block + 1, doc.blocks.begin() + hi.block + 1);
+    }
+    segments.erase(segments.begin() + lo.index, segments.begin() + hiIndex);
+    segments.insert(segments.begin() + lo.index, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+
+    update_bytes(doc.blocks[lo.block]);
+    doc.bytes += doc.blocks[lo.block].bytes;
+    if (segments.empty() && doc.blocks.size() > 1) {
+        doc.blocks.erase(doc.blocks.begin() + lo.block);
+    } else {
+        split_block(doc, lo.block);
+    }
+}
+
+// ---- Documents ----
+
+Document open_document(std::string_view src) {
+    Document doc;
+    std::vector<Segment> segments;
+    EditStats stats = {};
+    parse_window(src, NoSync, segments, stats, std::pmr::get_default_resource());
+    for (usize i = 0; i < segments.size(); i += SegmentBlockSize) {
+        SegmentBlock& block = doc.blocks.emplace_back();
+        const usize end = std::min(i + SegmentBlockSize, segments.size());
+        block.segments.assign(std::make_move_iterator(segments.begin() + i), std::make_move_iterator(segments.begin() + end));
+        update_bytes(block);
+        doc.bytes += block.bytes;
+    }
+    return doc;
+}
+
+// Apply `edit` to the document, re-lexing and re-parsing only the segments
+// around it. The window starts a whole segment before the first one the
+// edit changes, so the item there sees the same text and lookahead, and
+// ends with the segment after the last one it changes, where parsing has
+// to fall back into step with the old segments. If it does not, as when
+// the edit opens a parenthesis, the window grows until it does.
+EditStats apply_edit(Document& doc, const Edit& edit) {
+    const isize delta = isize(edit.text.size()) - isize(edit.length);
+    SegmentPos lo = locate(doc, edit.start);
+    if (lo.offset == edit.start) {
+        prev_segment(doc, lo);
+    }
+    prev_segment(doc, lo);
+    SegmentPos hi = locate(doc, edit.start + edit.length);
+    bool sync = next_segment(doc, hi);
+
+    EditStats stats = {};
+    std::vector<Segment> fresh;
+    for (usize grow = 1;; grow *= 2) {
+        std::string text;
+        for (SegmentPos pos = lo;;) {
+            text += segment_at(doc, pos).text;
+            if ((sync && pos.block == hi.block && pos.index == hi.index) || !next_segment(doc, pos)) {
+                break;
+            }
+        }
+        text.replace(edit.start - lo.offset, edit.length, edit.text);
+        const usize syncAt = sync ? hi.offset - lo.offset + delta : NoSync;
+        fresh.clear();
+        stats = {};
+        CompilationArena& scratch = *doc.scratch;
+        const bool fits = text.size() <= ScratchWindowBytes;
+        const bool synced = parse_window(text, syncAt, fresh, stats, fits ? scratch.resource() : std::pmr::get_default_resource());
+        if (fits) {
+            scratch.reset();
+        }
+        if (synced) {
+            break;
+        }
+        for (usize i = 0; i < grow && sync; i++) {
+            sync = next_segment(doc, hi);
+        }
+    }
+    replace_segments(doc, lo, hi, !sync, fresh);
+    return stats;
+}
+
+// The whole document as lex() and parse_program() produce it from its
+// text. Linear in the size of the document; edits never need it.
+struct DocumentSnapshot {
+    std::string src;
+    std::pmr::vector<Token> tokens;
+    Program program;
+};
+
+DocumentSnapshot document_snapshot(const Document& doc) {
+    DocumentSnapshot snap;
+    Program& program = snap.program;
+    snap.src.reserve(doc.bytes);
+    for (const SegmentBlock& block : doc.blocks) {
+        for (const Segment& s : block.segments) {
+            const usize byteBase = snap.src.size();
+            const usize tokBase = snap.tokens.size();
+            const usize nodeBase = program.exprs.size();
+            snap.src += s.text;
+            for (Token tok : s.tokens) {
+                tok.start += byteBase;
+                snap.tokens.push_back(tok);
+            }
+            if (program.error) {
+                continue;
+            }
+            if (s.error) {
+                program.error = s.error;
+                program.errorToken = tokBase + s.errorToken;
+            } else if (s.hasItem) {
+                program.exprs.insert(program.exprs.end(), s.exprs.begin(), s.exprs.end());
+                Item item = s.item;
+                rebase_item(item, program.exprs, tokBase, nodeBase);
+                program.items.push_back(item);
+            }
+        }
+    }
+    snap.tokens.push_back({ Token::Tag::Eof, snap.src.size() });
+    return snap;
+}
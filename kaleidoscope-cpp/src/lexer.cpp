@@ -1,74 +1,122 @@
 #include "token.hpp"
 #include "types.h"
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
-std::vector<Token> lex(const std::string& input) {
-    usize idx = 0;
-    std::vector<Token> tokens = {};
+// ASCII character classes; unlike <cctype> these are usable in constant
+// expressions and don't consult the locale.
+constexpr bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+constexpr bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
 
+constexpr bool is_alnum(char c) {
+    return is_alpha(c) || is_digit(c);
+}
+
+// Lex the token that follows `idx`, skipping whitespace and comments.
+// `idx` is left one past the end of the returned token.
+constexpr Token lex_next(std::string_view input, usize& idx) {
     while (idx < input.length()) {
         // Skip whitespace
-        while (input[idx] && isspace(input[idx])) {
+        while (idx < input.length() && is_space(input[idx])) {
             idx++;
         }
         if (idx >= input.length()) {
             break;
         }
-        if (isalpha(input[idx])) {
+        if (is_alpha(input[idx])) {
             // Lex keyword or identifier
             usize start = idx;
-            std::string idStr = "";
-            while (isalnum(input[idx])) {
-                idStr += input[idx];
+            while (idx < input.length() && is_alnum(input[idx])) {
                 idx++;
             }
+            std::string_view idStr = input.substr(start, idx - start);
             if (idStr == "def") {
-                tokens.emplace_back(Token::Tag::Def, start);
+                return { Token::Tag::Def, start };
             } else if (idStr == "extern") {
-                tokens.emplace_back(Token::Tag::Extern, start);
+                return { Token::Tag::Extern, start };
             } else {
-                tokens.emplace_back(Token::Tag::Id, start);
+                return { Token::Tag::Id, start };
             }
-        } else if (isdigit(input[idx]) || input[idx] == '.') {
+        } else if (is_digit(input[idx]) || input[idx] == '.') {
             // Lex number
             usize start = idx;
-            while (isdigit(input[idx]) || input[idx] == '.') {
+            while (idx < input.length() && (is_digit(input[idx]) || input[idx] == '.')) {
                 idx++;
             }
-            tokens.emplace_back(Token::Tag::Num, start);
+            return { Token::Tag::Num, start };
         } else if (input[idx] == '#') {
             // Skip comment
-            while (input[idx] && input[idx] != '\n' && input[idx] != '\r') {
+            while (idx < input.length() && input[idx] != '\n' && input[idx] != '\r') {
                 idx++;
             }
         } else {
-            switch (input[idx]) {
+            usize start = idx++;
+            switch (input[start]) {
             case '(':
-                tokens.emplace_back(Token::Tag::LParen, idx);
-                break;
+                return { Token::Tag::LParen, start };
             case ')':
-                tokens.emplace_back(Token::Tag::RParen, idx);
-                break;
+                return { Token::Tag::RParen, start };
             case ';':
-                tokens.emplace_back(Token::Tag::Semicolon, idx);
-                break;
+                return { Token::Tag::Semicolon, start };
             case '+':
-                tokens.emplace_back(Token::Tag::Plus, idx);
-                break;
+                return { Token::Tag::Plus, start };
             case '-':
-                tokens.emplace_back(Token::Tag::Minus, idx);
-                break;
+                return { Token::Tag::Minus, start };
             case '*':
-                tokens.emplace_back(Token::Tag::Star, idx);
-                break;
+                return { Token::Tag::Star, start };
+            case ',':
+                return { Token::Tag::Comma, start };
+            case '<':
+                return { Token::Tag::Less, start };
             default:
-                tokens.emplace_back(Token::Tag::Other, idx);
+                return { Token::Tag::Other, start };
             }
-            idx++;
         }
     }
 
-    tokens.emplace_back(Token::Tag::Eof, idx);
+    return { Token::Tag::Eof, idx };
+}
+
+// Source text of a token, recovered by lexing it again from its start.
+constexpr std::string_view token_text(std::string_view input, const Token& tok) {
+    usize idx = tok.start;
+    lex_next(input, idx);
+    return input.substr(tok.start, idx - tok.start);
+}
+
+template <class Tokens>
+constexpr void lex_into(std::string_view input, Tokens& tokens) {
+    usize idx = 0;
+    while (true) {
+        tokens.push_back(lex_next(input, idx));
+        if (tokens.back().tag == Token::Tag::Eof) {
+            break;
+        }
+    }
+}
+
+constexpr std::vector<Token> lex(std::string_view input) {
+    std::vector<Token> tokens = {};
+    lex_into(input, tokens);
+    return tokens;
+}
+
+std::pmr::vector<Token> lex(std::string_view input, std::pmr::memory_resource* resource) {
+    std::pmr::vector<Token> tokens(resource);
+    // Typical source averages a token every few bytes; reserving up front
+    // avoids most of the regrowth, which a bump allocator never reclaims.
+    tokens.reserve(input.size() / 4 + 1);
+    lex_into(input, tokens);
     return tokens;
-};
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "types.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct SourcePosition {
+    usize line; // 1-based
+    usize column; // 1-based, in bytes
+};
+
+// Sorted byte offsets of every line start in a source, built on demand so
+// the lexer never tracks positions; offsets map back by binary search.
+class LineIndex {
+public:
+    explicit LineIndex(std::string_view src) {
+        starts.resize(scan_newlines(src, nullptr) + 1);
+        starts[0] = 0;
+        scan_newlines(src, starts.data() + 1);
+    }
+
+    SourcePosition locate(usize offset) const {
+        auto next = std::upper_bound(starts.begin(), starts.end(), offset);
+        usize line = next - starts.begin();
+        return { line, offset - starts[line - 1] + 1 };
+    }
+
+    usize line_count() const {
+        return starts.size();
+    }
+
+private:
+    std::vector<usize> starts;
+
+    // Count the line starts after each '\n', storing them unless `out` is
+    // null. Compares 16 bytes at a time where SSE2 is available; memchr()
+    // handles the tail.
+    static usize scan_newlines(std::string_view src, usize* out) {
+        const char* data = src.data();
+        usize length = src.size();
+        usize count = 0;
+        usize pos = 0;
+#ifdef __SSE2__
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; pos + 16 <= length; pos += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+            u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+            if (!out) {
+                count += __builtin_popcount(mask);
+                continue;
+            }
+            while (mask) {
+                out[count++] = pos + __builtin_ctz(mask) + 1;
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (auto nl = static_cast<const char*>(memchr(data + pos, '\n', length - pos)); nl;
+             nl = static_cast<const char*>(memchr(nl + 1, '\n', length - (nl + 1 - data)))) {
+            if (out) {
+                out[count] = nl - data + 1;
+            }
+            count++;
+        }
+        return count;
+    }
+};
@@ -1,25 +1,138 @@
+#include "arena.hpp"
 #include "lexer.cpp"
+#include "parser.cpp"
+#include "formula.cpp"
+#include "incremental.cpp"
+#include "dump.cpp"
+#include "lines.hpp"
+#include "stats.hpp"
+#include <cstring>
 #include <fstream>
 #include <sstream>
-#include <iostream> 
+#include <unistd.h>
 #include <vector>
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
+    bool parseMode = false;
+    bool binary = false;
+    bool heap = false;
+    usize parseThreads = 1;
+    std::vector<Edit> edits;
+    Stats stats;
+    const char* filename = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--parse") == 0) {
+            parseMode = true;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            binary = true;
+        } else if (strcmp(argv[i], "--heap") == 0) {
+            heap = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            parseThreads = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--edit") == 0 && i + 1 < argc) {
+            // START:LENGTH:TEXT, where TEXT may hold colons of its own.
+            char* end;
+            Edit edit;
+            edit.start = strtoul(argv[++i], &end, 10);
+            edit.length = *end == ':' ? strtoul(end + 1, &end, 10) : 0;
+            if (*end != ':') {
+                fprintf(stderr, "--edit expects START:LENGTH:TEXT, got %s\n", argv[i]);
+                return 1;
+            }
+            edit.text = end + 1;
+            edits.push_back(std::move(edit));
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats.enabled = true;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (!filename) {
         fprintf(stderr, "Filename required");
         return 1;
     }
+    stats.file = filename;
 
-    std::ifstream t(argv[1]);
+    u64 start = stats.begin();
+    std::ifstream t(filename);
     std::stringstream buffer;
     buffer << t.rdbuf();
+    std::string src = buffer.str();
+    stats.end(Stats::Phase::Load, start);
 
-    std::vector<Token> tokens = lex(buffer.str());
+    // Tokens and AST come from one arena unless --heap asks for the global
+    // allocator, which is kept for comparison.
+    CompilationArena arena;
+    std::pmr::memory_resource* resource = heap ? std::pmr::get_default_resource() : arena.resource();
+    // Every way out from here, failed or not, reports `--stats` for as far
+    // as the run got.
+    auto finish = [&](int status) {
+        if (stats.enabled) {
+            stats.arenaReservedBytes = heap ? 0 : arena.reserved_bytes();
+            stats.print_json(stderr);
+        }
+        return status;
+    };
 
-    for (Token tok : tokens) {
-        std::cout << tok.str() << ",";
+    std::pmr::vector<Token> tokens(resource);
+    Program program(resource);
+    if (edits.empty()) {
+        start = stats.begin();
+        tokens = lex(src, resource);
+        stats.end(Stats::Phase::Lex, start);
+    } else {
+        // Open the file as a document, apply the edits to it one at a time
+        // and go on with what they leave, as if that had been the file.
+        start = stats.begin();
+        Document doc = open_document(src);
+        stats.end(Stats::Phase::Parse, start);
+        start = stats.begin();
+        for (const Edit& edit : edits) {
+            if (edit.start > doc.bytes || edit.length > doc.bytes - edit.start) {
+                fprintf(stderr, "--edit %zu:%zu: past the end of %zu bytes\n", edit.start, edit.length, doc.bytes);
+                return finish(1);
+            }
+            apply_edit(doc, edit);
+        }
+        stats.end(Stats::Phase::Edit, start);
+        DocumentSnapshot snap = document_snapshot(doc);
+        src = std::move(snap.src);
+        tokens = std::move(snap.tokens);
+        program = std::move(snap.program);
     }
-    std::cout << "\n";
+    stats.bytes = src.size();
+    stats.count_tokens(tokens);
 
-    return 0;
+    Emitter out(STDOUT_FILENO);
+    if (parseMode) {
+        if (edits.empty()) {
+            start = stats.begin();
+            program = parseThreads > 1 ? parse_program_parallel(tokens, parseThreads, resource) : parse_program(tokens, resource);
+            stats.end(Stats::Phase::Parse, start);
+        }
+        stats.count_program(program);
+        if (program.error) {
+            SourcePosition pos = LineIndex(src).locate(tokens[program.errorToken].start);
+            fprintf(stderr, "%s:%zu:%zu: parse error: %s\n", filename, pos.line, pos.column, program.error);
+            return finish(1);
+        }
+        start = stats.begin();
+        if (binary) {
+            dump_program_binary(out, program);
+        } else {
+            dump_program_text(out, src, tokens, program);
+        }
+        out.flush();
+        stats.end(Stats::Phase::Dump, start);
+    } else {
+        start = stats.begin();
+        if (binary) {
+            dump_tokens_binary(out, tokens);
+        } else {
+            dump_tokens_text(out, tokens);
+        }
+        out.flush();
+        stats.end(Stats::Phase::Dump, start);
+    }
+    return finish(0);
 }
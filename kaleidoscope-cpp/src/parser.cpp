@@ -1,204 +1,411 @@
 #include "ast.hpp"
 #include "token.hpp"
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <memory_resource>
+#include <span>
+#include <thread>
 #include <vector>
 
+// Parses into any vector of Expr, so the same code fills pmr-backed
+// programs at runtime and plain vectors during constant evaluation.
+template <class Exprs>
+struct Parser {
+    std::span<const Token> tokens;
+    Exprs& exprs;
+    // Index that exprs[0] will have in the final node array, so that nodes
+    // parsed into a scratch buffer can be spliced in without rebasing.
+    usize nodeBase;
+    usize idx;
+    const char* error = nullptr;
+    usize errorToken = 0;
+};
 
-// static bool consume_tok(Token tokens[], usize* idx, const Token token) {
-//     if (token_equals(tokens[*idx], token)) {
-//         progress(idx);
-//         return true;
-//     } else {
-//         return false;
-//     }
-// }
-
-// static const char* expect_id(Token tokens[], usize* idx) {
-//     if (tokens[*idx].kind == TokIdentifier) {
-//         progress(idx);
-//         return tokens[*idx].value.identifier;
-//     }
-//     return NULL;
-// }
-
-// static ExprAST* parse_expression(Arena* a, Token tokens[], usize* idx);
-
-// static ExprAST* parse_number(Arena* a, Token tokens[], usize* idx) {
-//     if (tokens[*idx].kind != TokNumber) {
-//         parse_error("Expected number");
-//     }
-//     ExprAST* expr = arena_alloc(a, sizeof(ExprAST));
-//     expr->type = ExprNumberType;
-//     expr->value.numberValue = tokens[*idx].value.number;
-//     progress(idx);
-//     return expr;
-// }
-
-// static ExprAST* parse_paren_expr(Arena* a, Token tokens[], usize* idx) {
-//     if (!consume_tok(tokens, idx, LEFT_PAREN)) {
-//         parse_error("Expected left paren");
-//     }
-//     ExprAST* expr = parse_expression(a, tokens, idx);
-//     if (!consume_tok(tokens, idx, RIGHT_PAREN)) {
-//         parse_error("Expected right paren");
-//     }
-//     return expr;
-// }
-
-// static bool token_char_equals(Token t, char c) {
-//     Token t1 = {
-//         .kind = TokOther,
-//         .value = { .other = c }
-//     };
-//     return token_equals(t1, t);
-// }
-
-// static usize count_args(Token tokens[], usize idx) {
-//     usize count = 0;
-//     while (!token_char_equals(tokens[idx], ')')) {
-//         if (token_char_equals(tokens[idx], ',')) {
-//             count++;
-//         }
-//         idx++;
-//     }
-//     return count;
-// }
-
-// static ExprAST* parse_identifier_expr(Arena* a, Token tokens[], usize* idx) {
-//     const char* identifier = expect_id(tokens, idx);
-//     if (!identifier) {
-//         parse_error("Expected identifier");
-//     }
-//     if (!token_char_equals(tokens[*idx], '(')) {
-//         ExprAST* expr = arena_alloc(a, sizeof(ExprAST));
-//         expr->type = ExprVariableType;
-//         expr->value.variableName = identifier;
-//         return expr;
-//     }
-//     consume_tok(tokens, idx, RIGHT_PAREN);
-//     const usize argsCount = count_args(tokens, *idx);
-//     ExprAST** args = arena_alloc(a, sizeof(ExprAST*) * argsCount);
-//     usize argsIdx = 0;
-//     if (!token_char_equals(tokens[*idx], ')')) {
-//         while (true) {
-//             ExprAST* expr = parse_expression(a, tokens, idx);
-//             args[argsIdx++] = expr;
-//             if (token_char_equals(tokens[*idx], ')')) {
-//                 break;
-//             }
-//             if (!consume_tok(tokens, idx, COMMA)) {
-//                 parse_error("Expected comma in argument list");
-//             }
-//         }
-//         consume_tok(tokens, idx, LEFT_PAREN);
-//     }
-//     ExprAST* callExpr = arena_alloc(a, sizeof(ExprAST));
-//     callExpr->type = ExprCallType;
-//     callExpr->value.call.callee = identifier;
-//     callExpr->value.call.argsCount = argsCount;
-//     callExpr->value.call.args = args;
-//     return callExpr;
-// }
-
-// static ExprAST* parse_primary(Arena* a, Token tokens[], usize* idx) {
-//     switch (tokens[*idx].kind) {
-//     case TokIdentifier:
-//         return parse_identifier_expr(a, tokens, idx);
-//     case TokNumber:
-//         return parse_number(a, tokens, idx);
-//     case TokOther:
-//         if (tokens[*idx].value.other == '(') {
-//             return parse_paren_expr(a, tokens, idx);
-//         }
-//         // fallthrough
-//     default:
-//         parse_error("Unknown token when expecting expression");
-//         return NULL;
-//     }
-// }
-
-// static int binop_precedence(char op) {
-//     switch (op) {
-//     case '<':
-//         return 10;
-//     case '+':
-//     case '-':
-//         return 20;
-//     case '*':
-//         return 40;
-//     default:
-//         return -1;
-//     }
-// }
-
-// static int get_tok_precedence(Token t) {
-//     if (t.kind != TokOther) {
-//         return -1;
-//     }
-
-//     return binop_precedence(t.value.other);
-// }
-
-// static ExprAST* parse_binop_rhs(Arena* a, Token tokens[], usize* idx, int exprPrec, ExprAST* lhs) {
-//     while (true) {
-//         int tokPrec = get_tok_precedence(tokens[*idx]);
-//         if (tokPrec < exprPrec) {
-//             return lhs;
-//         }
-//         // We have a binop
-//         char binop = tokens[*idx].value.other;
-//         progress(idx);
-//         ExprAST* rhs = parse_primary(a, tokens, idx);
-//         int nextPrec = get_tok_precedence(tokens[*idx]);
-//         if (tokPrec < nextPrec) {
-//             // Binop binds less tightly with rhs than operator after rhs
-//             rhs = parse_binop_rhs(a, tokens, idx, tokPrec + 1, rhs);
-//         }
-//         // Merge lhs/rhs
-//         ExprAST* prevLhs = lhs;
-//         lhs = arena_alloc(a, sizeof(ExprAST));
-//         lhs->type = ExprBinopType;
-//         lhs->value.binop.op = binop;
-//         lhs->value.binop.lhs = prevLhs;
-//         lhs->value.binop.rhs = rhs;
-//     }
-// }
-
-ExprAST parse_expression(const std::string src, const std::vector<Token> tokens)) {
-    ExprAST* lhs = parse_primary(a, tokens, idx);
-    return parse_binop_rhs(a, tokens, idx, 0, lhs);
+template <class Exprs>
+static constexpr usize parse_error(Parser<Exprs>& p, const char* msg) {
+    if (!p.error) {
+        p.error = msg;
+        p.errorToken = p.idx;
+    }
+    return NoExpr;
+}
+
+template <class Exprs>
+static constexpr Token::Tag peek(const Parser<Exprs>& p) {
+    return p.tokens[p.idx].tag;
+}
+
+template <class Exprs>
+static constexpr bool consume_tok(Parser<Exprs>& p, Token::Tag tag) {
+    if (peek(p) == tag) {
+        p.idx++;
+        return true;
+    }
+    return false;
+}
+
+template <class Exprs>
+static constexpr usize push_expr(Parser<Exprs>& p, Expr::Tag tag, usize token, usize lhs, usize rhs) {
+    p.exprs.push_back({ tag, token, lhs, rhs });
+    return p.nodeBase + p.exprs.size() - 1;
+}
+
+template <class Exprs>
+static constexpr Expr& expr_at(Parser<Exprs>& p, usize node) {
+    return p.exprs[node - p.nodeBase];
+}
+
+template <class Exprs>
+static constexpr usize parse_expression(Parser<Exprs>& p);
+
+template <class Exprs>
+static constexpr usize parse_paren_expr(Parser<Exprs>& p) {
+    if (!consume_tok(p, Token::Tag::LParen)) {
+        return parse_error(p, "Expected left paren");
+    }
+    usize expr = parse_expression(p);
+    if (p.error) {
+        return NoExpr;
+    }
+    if (!consume_tok(p, Token::Tag::RParen)) {
+        return parse_error(p, "Expected right paren");
+    }
+    return expr;
+}
+
+template <class Exprs>
+static constexpr usize parse_identifier_expr(Parser<Exprs>& p) {
+    const usize id = p.idx++;
+    if (!consume_tok(p, Token::Tag::LParen)) {
+        return push_expr(p, Expr::Tag::Variable, id, NoExpr, NoExpr);
+    }
+    usize firstArg = NoExpr;
+    usize lastArg = NoExpr;
+    if (!consume_tok(p, Token::Tag::RParen)) {
+        while (true) {
+            usize value = parse_expression(p);
+            if (p.error) {
+                return NoExpr;
+            }
+            usize arg = push_expr(p, Expr::Tag::Arg, NoExpr, value, NoExpr);
+            if (lastArg == NoExpr) {
+                firstArg = arg;
+            } else {
+                expr_at(p, lastArg).rhs = arg;
+            }
+            lastArg = arg;
+            if (consume_tok(p, Token::Tag::RParen)) {
+                break;
+            }
+            if (!consume_tok(p, Token::Tag::Comma)) {
+                return parse_error(p, "Expected comma in argument list");
+            }
+        }
+    }
+    return push_expr(p, Expr::Tag::Call, id, firstArg, NoExpr);
+}
+
+template <class Exprs>
+static constexpr usize parse_primary(Parser<Exprs>& p) {
+    switch (peek(p)) {
+    case Token::Tag::Id:
+        return parse_identifier_expr(p);
+    case Token::Tag::Num:
+        return push_expr(p, Expr::Tag::Number, p.idx++, NoExpr, NoExpr);
+    case Token::Tag::LParen:
+        return parse_paren_expr(p);
+    default:
+        return parse_error(p, "Unknown token when expecting expression");
+    }
+}
+
+static constexpr int get_tok_precedence(Token::Tag tag) {
+    switch (tag) {
+    case Token::Tag::Less:
+        return 10;
+    case Token::Tag::Plus:
+    case Token::Tag::Minus:
+        return 20;
+    case Token::Tag::Star:
+        return 40;
+    default:
+        return -1;
+    }
+}
+
+template <class Exprs>
+static constexpr usize parse_binop_rhs(Parser<Exprs>& p, int exprPrec, usize lhs) {
+    while (true) {
+        int tokPrec = get_tok_precedence(peek(p));
+        if (tokPrec < exprPrec) {
+            return lhs;
+        }
+        // We have a binop
+        usize binop = p.idx++;
+        usize rhs = parse_primary(p);
+        if (p.error) {
+            return NoExpr;
+        }
+        int nextPrec = get_tok_precedence(peek(p));
+        if (tokPrec < nextPrec) {
+            // Binop binds less tightly with rhs than operator after rhs
+            rhs = parse_binop_rhs(p, tokPrec + 1, rhs);
+            if (p.error) {
+                return NoExpr;
+            }
+        }
+        // Merge lhs/rhs
+        lhs = push_expr(p, Expr::Tag::Binop, binop, lhs, rhs);
+    }
+}
+
+template <class Exprs>
+static constexpr usize parse_expression(Parser<Exprs>& p) {
+    usize lhs = parse_primary(p);
+    if (p.error) {
+        return NoExpr;
+    }
+    return parse_binop_rhs(p, 0, lhs);
 }
 
 // ---- Prototypes ----
 
-// static usize count_arg_names(Token tokens[], usize idx) {
-//     usize count = 0;
-//     while (!token_char_equals(tokens[idx++], ')')) {
-//         count++;
-//     }
-//     return count;
-// }
-
-// static PrototypeAST* parse_prototype(Arena* a, Token tokens[], usize* idx) {
-//     const char* fnName = expect_id(tokens, idx);
-//     if (!fnName) {
-//         parse_error("Expected function name");
-//     }
-//     if (!consume_tok(tokens, idx, LEFT_PAREN)) {
-//         parse_error("Expected open paren");
-//     }
-//     const usize argNameCnt = count_arg_names(tokens, *idx);
-//     const char** argNames = arena_alloc(a, sizeof(char*) * argNameCnt);
-//     usize i = 0;
-//     while (!token_char_equals(tokens[*idx], ')') && tokens[*idx].kind == TokIdentifier) {
-//         argNames[i++] = expect_id(tokens, idx);
-//     }
-//     consume_tok(tokens, idx, RIGHT_PAREN);
-//     PrototypeAST* proto = arena_alloc(a, sizeof(PrototypeAST));
-//     proto->name = fnName;
-//     proto->argsCount = argNameCnt;
-//     proto->args = argNames;
-//     return proto;
-// }
+template <class Exprs>
+static constexpr bool parse_prototype(Parser<Exprs>& p, Item& item) {
+    if (peek(p) != Token::Tag::Id) {
+        parse_error(p, "Expected function name");
+        return false;
+    }
+    item.proto = p.idx++;
+    if (!consume_tok(p, Token::Tag::LParen)) {
+        parse_error(p, "Expected open paren");
+        return false;
+    }
+    item.paramCount = 0;
+    while (consume_tok(p, Token::Tag::Id)) {
+        item.paramCount++;
+    }
+    if (!consume_tok(p, Token::Tag::RParen)) {
+        parse_error(p, "Expected close paren");
+        return false;
+    }
+    return true;
+}
+
+// ---- Top level ----
+
+template <class Exprs>
+constexpr void skip_separators(Parser<Exprs>& p) {
+    while (consume_tok(p, Token::Tag::Semicolon)) { }
+}
+
+// Parse one `def`, `extern` or top-level expression starting at p.idx.
+template <class Exprs>
+constexpr bool parse_item(Parser<Exprs>& p, Item& item) {
+    item.tokBegin = p.idx;
+    item.exprBegin = p.nodeBase + p.exprs.size();
+    item.proto = NoExpr;
+    item.paramCount = 0;
+    item.body = NoExpr;
+    if (consume_tok(p, Token::Tag::Def)) {
+        item.tag = Item::Tag::Def;
+        if (!parse_prototype(p, item)) {
+            return false;
+        }
+        item.body = parse_expression(p);
+    } else if (consume_tok(p, Token::Tag::Extern)) {
+        item.tag = Item::Tag::Extern;
+        parse_prototype(p, item);
+    } else {
+        item.tag = Item::Tag::Expr;
+        item.body = parse_expression(p);
+    }
+    item.tokEnd = p.idx;
+    item.exprEnd = p.nodeBase + p.exprs.size();
+    return !p.error;
+}
+
+Program parse_program(std::span<const Token> tokens, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+    Program program(resource);
+    // Every node but Arg consumes a token and every Arg follows a '(' or
+    // ',', so this reservation is never outgrown.
+    program.exprs.reserve(tokens.size());
+    Parser<std::pmr::vector<Expr>> p = { tokens, program.exprs, 0, 0 };
+    while (true) {
+        skip_separators(p);
+        if (peek(p) == Token::Tag::Eof) {
+            break;
+        }
+        Item item;
+        if (!parse_item(p, item)) {
+            break;
+        }
+        program.items.push_back(item);
+    }
+    program.error = p.error;
+    program.errorToken = p.errorToken;
+    return program;
+}
+
+// Parse the whole token stream as a single expression. Returns the error
+// message, or nullptr on success.
+constexpr const char* parse_formula(std::span<const Token> tokens, ExprAST& ast) {
+    Parser<std::vector<Expr>> p = { tokens, ast.exprs, 0, 0 };
+    ast.root = parse_expression(p);
+    if (!p.error && peek(p) != Token::Tag::Eof) {
+        parse_error(p, "Unexpected token after expression");
+    }
+    return p.error;
+}
+
+// Shift an item and its nodes after tokens and nodes were inserted or
+// removed in front of it. The nodes must already sit at their new position.
+void rebase_item(Item& item, std::span<Expr> exprs, isize tokDelta, isize nodeDelta) {
+    for (usize i = item.exprBegin + nodeDelta; i < item.exprEnd + nodeDelta; i++) {
+        Expr& e = exprs[i];
+        if (e.token != NoExpr) {
+            e.token += tokDelta;
+        }
+        if (e.lhs != NoExpr) {
+            e.lhs += nodeDelta;
+        }
+        if (e.rhs != NoExpr) {
+            e.rhs += nodeDelta;
+        }
+    }
+    item.tokBegin += tokDelta;
+    item.tokEnd += tokDelta;
+    if (item.proto != NoExpr) {
+        item.proto += tokDelta;
+    }
+    if (item.body != NoExpr) {
+        item.body += nodeDelta;
+    }
+    item.exprBegin += nodeDelta;
+    item.exprEnd += nodeDelta;
+}
+
+// ---- Parallel parsing ----
+
+// Ranges are kept small enough for a worker's nodes to still be in cache
+// when it appends them, but large enough to amortize taking turns.
+constexpr usize ParseRangeMinTokens = 16 * 1024;
+constexpr usize ParseRangeMaxTokens = 64 * 1024;
+
+// A run of whole items: tokens [tokBegin, tokEnd).
+struct ParseRange {
+    usize tokBegin;
+    usize tokEnd;
+};
+
+// Cut the token stream into about `parts` ranges of whole items. No item
+// contains a `;`, `def` or `extern`, so the cuts go right after the first
+// `;`, or right before the first `def`/`extern`, past each even share.
+static std::vector<ParseRange> split_items(std::span<const Token> tokens, usize parts) {
+    const usize count = tokens.size() - 1; // without Eof
+    const usize share = std::clamp(count / parts, ParseRangeMinTokens, ParseRangeMaxTokens);
+    std::vector<ParseRange> ranges;
+    usize begin = 0;
+    for (usize idx = share; idx < count; idx++) {
+        usize cut;
+        switch (tokens[idx].tag) {
+        case Token::Tag::Def:
+        case Token::Tag::Extern:
+            cut = idx;
+            break;
+        case Token::Tag::Semicolon:
+            cut = idx + 1;
+            break;
+        default:
+            continue;
+        }
+        ranges.push_back({ begin, cut });
+        begin = cut;
+        idx = cut + share - 1;
+    }
+    ranges.push_back({ begin, tokens.size() });
+    return ranges;
+}
+
+// One thread's node buffer, reused for every range it parses.
+struct ParseWorker {
+    std::vector<Expr> exprs;
+    std::vector<Item> items;
+};
+
+// Parse `range` into the worker's buffer, with node indices from 0.
+template <class Exprs>
+static Parser<Exprs> parse_range(std::span<const Token> tokens, ParseRange range, ParseWorker& w) {
+    w.exprs.clear();
+    w.items.clear();
+    Parser<Exprs> p = { tokens, w.exprs, 0, range.tokBegin };
+    while (true) {
+        skip_separators(p);
+        if (p.idx >= range.tokEnd || peek(p) == Token::Tag::Eof) {
+            break;
+        }
+        Item item;
+        if (!parse_item(p, item)) {
+            break;
+        }
+        w.items.push_back(item);
+    }
+    return p;
+}
+
+// parse_program() on `threads` threads. Workers claim ranges of items in
+// order and parse each into their own node buffer. They then take turns,
+// in source order, appending their nodes to the program and rebasing
+// their items onto them, so only that copy is serial. The result is the
+// same as parse_program()'s.
+Program parse_program_parallel(std::span<const Token> tokens, usize threads, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+    Program program(resource);
+    program.exprs.reserve(tokens.size());
+    const std::vector<ParseRange> ranges = split_items(tokens, threads * 8);
+    std::atomic<usize> next = 0;
+    std::atomic<usize> merged = 0; // ranges appended so far
+    std::atomic<bool> stopped = false; // an error ended the parse
+
+    usize longest = 0;
+    for (ParseRange range : ranges) {
+        longest = std::max(longest, range.tokEnd - range.tokBegin);
+    }
+
+    auto work = [&] {
+        // Sized once for any range, so the buffer is never reallocated
+        // and its pages are only faulted in by the first range.
+        ParseWorker w;
+        w.exprs.reserve(longest);
+        for (usize r; (r = next.fetch_add(1)) < ranges.size() && !stopped.load();) {
+            Parser<std::vector<Expr>> p = parse_range<std::vector<Expr>>(tokens, ranges[r], w);
+            for (usize m; (m = merged.load(std::memory_order_acquire)) != r && !stopped.load();) {
+                merged.wait(m);
+            }
+            if (stopped.load()) {
+                break;
+            }
+            const isize nodeBase = program.exprs.size();
+            program.exprs.insert(program.exprs.end(), w.exprs.begin(), w.exprs.end());
+            for (Item& item : w.items) {
+                rebase_item(item, program.exprs, 0, nodeBase);
+                program.items.push_back(item);
+            }
+            if (p.error) {
+                program.error = p.error;
+                program.errorToken = p.errorToken;
+                stopped.store(true);
+            }
+            merged.store(r + 1, std::memory_order_release);
+            merged.notify_all();
+        }
+    };
+    std::vector<std::thread> pool;
+    for (usize t = 1; t < std::min(threads, ranges.size()); t++) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    return program;
+}
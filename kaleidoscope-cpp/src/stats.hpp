@@ -0,0 +1,109 @@
+#pragma once
+#include "ast.hpp"
+#include "token.hpp"
+#include "types.h"
+#include <chrono>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <sys/resource.h>
+
+// Per-run counters for `--stats`. Everything is gated on `enabled`, so a
+// run without `--stats` only pays a branch per phase.
+struct Stats {
+    enum class Phase {
+        Load, Lex, Parse, Edit, Dump
+    };
+    static constexpr usize phaseCount = usize(Phase::Dump) + 1;
+
+    bool enabled = false;
+    std::string file;
+    bool ran[phaseCount] = {};
+    u64 phaseNs[phaseCount] = {};
+    u64 bytes = 0;
+    u64 tokens = 0;
+    u64 tokensByTag[Token::tagCount] = {};
+    u64 items = 0;
+    u64 astNodes = 0;
+    u64 arenaReservedBytes = 0;
+
+    static u64 now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    u64 begin() const {
+        return enabled ? now_ns() : 0;
+    }
+
+    void end(Phase phase, u64 start) {
+        if (enabled) {
+            phaseNs[usize(phase)] += now_ns() - start;
+            ran[usize(phase)] = true;
+        }
+    }
+
+    void count_tokens(std::span<const Token> toks) {
+        if (!enabled) {
+            return;
+        }
+        for (const Token& tok : toks) {
+            if (tok.tag != Token::Tag::Eof) {
+                tokensByTag[usize(tok.tag)]++;
+                tokens++;
+            }
+        }
+    }
+
+    void count_program(const Program& program) {
+        if (enabled) {
+            items += program.items.size();
+            astNodes += program.exprs.size();
+        }
+    }
+
+    void print_json(FILE* out) const {
+        static const char* phaseNames[phaseCount] = { "load", "lex", "parse", "edit", "dump" };
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        fprintf(out, "{\n  \"file\": \"");
+        for (char c : file) {
+            if (c == '"' || c == '\\') {
+                fputc('\\', out);
+            }
+            fputc(c, out);
+        }
+        fprintf(out, "\",\n  \"bytes\": %llu,\n  \"phases_ns\": {", (unsigned long long)bytes);
+        bool first = true;
+        for (usize i = 0; i < phaseCount; i++) {
+            if (ran[i]) {
+                fprintf(out, "%s \"%s\": %llu", first ? "" : ",", phaseNames[i], (unsigned long long)phaseNs[i]);
+                first = false;
+            }
+        }
+        fprintf(out, " },\n  \"tokens\": %llu,\n  \"tokens_by_kind\": {", (unsigned long long)tokens);
+        first = true;
+        for (usize i = 0; i < Token::tagCount; i++) {
+            if (tokensByTag[i]) {
+                fprintf(out, "%s \"%s\": %llu", first ? "" : ",", Token::tag_name(Token::Tag(i)), (unsigned long long)tokensByTag[i]);
+                first = false;
+            }
+        }
+        fprintf(out, " },\n  \"items\": %llu,\n  \"ast_nodes\": %llu,\n", (unsigned long long)items, (unsigned long long)astNodes);
+        fprintf(out, "  \"arena_reserved_bytes\": %llu,\n", (unsigned long long)arenaReservedBytes);
+        fprintf(out, "  \"peak_rss_bytes\": %llu,\n  \"throughput\": {", (unsigned long long)usage.ru_maxrss * 1024);
+        first = true;
+        for (Phase phase : { Phase::Lex, Phase::Parse }) {
+            if (!ran[usize(phase)] || phaseNs[usize(phase)] == 0) {
+                continue;
+            }
+            double seconds = phaseNs[usize(phase)] / 1e9;
+            fprintf(out, "%s\n    \"%s\": { \"mb_per_s\": %.3f, \"tokens_per_s\": %.0f }",
+                first ? "" : ",", phaseNames[usize(phase)], bytes / 1e6 / seconds, tokens / seconds);
+            first = false;
+        }
+        fprintf(out, "\n  }\n}\n");
+    }
+};
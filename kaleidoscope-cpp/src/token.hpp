@@ -1,19 +1,17 @@
 #pragma once
 #include "types.h"
-#include <sstream>
-#include <string>
 
 struct Token {
     enum class Tag {
-        Eof, Def, Extern, Id, Num, LParen, RParen, Semicolon, Plus, Minus, Star, Other
+        Eof, Def, Extern, Id, Num, LParen, RParen, Semicolon, Plus, Minus, Star, Comma, Less, Other
     };
     Tag tag;
     usize start;
 
-    std::string str() {
-        static const std::string tagStrs[] = {"eof", "def", "extern", "id", "num", "lparen", "rparen", ";", "+", "-", "*", "other"};
-        std::ostringstream out;
-        out << "{" << tagStrs[usize(tag)] << "," << start << "}";
-        return out.str();
+    static constexpr usize tagCount = usize(Tag::Other) + 1;
+
+    static const char* tag_name(Tag tag) {
+        static const char* tagStrs[tagCount] = {"eof", "def", "extern", "id", "num", "lparen", "rparen", ";", "+", "-", "*", ",", "<", "other"};
+        return tagStrs[usize(tag)];
     }
 };
@@ -13,3 +13,4 @@ typedef double f64;
 typedef uintptr_t uptr;
 typedef char byte;
 typedef size_t usize;
+typedef ptrdiff_t isize;
@@ -0,0 +1,37 @@
+// Check that "..."_ks formulas hold what lexing and parsing the same text
+// at run time gives.
+#include "../src/lexer.cpp"
+#include "../src/parser.cpp"
+#include "../src/formula.cpp"
+#include <cstdio>
+
+template <usize TokenCount, usize ExprCount>
+static bool matches_runtime(const Formula<TokenCount, ExprCount>& formula) {
+    std::vector<Token> tokens = lex(formula.src);
+    ExprAST ast;
+    if (parse_formula(tokens, ast) || tokens.size() != TokenCount || ast.exprs.size() != ExprCount || ast.root != formula.root) {
+        return false;
+    }
+    for (usize i = 0; i < TokenCount; i++) {
+        if (tokens[i].tag != formula.tokens[i].tag || tokens[i].start != formula.tokens[i].start) {
+            return false;
+        }
+    }
+    for (usize i = 0; i < ExprCount; i++) {
+        const Expr& a = ast.exprs[i];
+        const Expr& b = formula.exprs[i];
+        if (a.tag != b.tag || a.token != b.token || a.lhs != b.lhs || a.rhs != b.rhs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    constexpr auto linear = "a * x + b"_ks;
+    constexpr auto nested = "1 + (2 - 5) * f(x)"_ks;
+    constexpr auto call = "g(x < y, h(), 0.5 * z)"_ks;
+    const bool ok = matches_runtime(linear) && matches_runtime(nested) && matches_runtime(call);
+    printf("formula: %s\n", ok ? "literals match a run-time parse" : "literals differ from a run-time parse");
+    return ok ? 0 : 1;
+}
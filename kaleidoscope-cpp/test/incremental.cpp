@@ -0,0 +1,129 @@
+// Apply random edits to documents and check after each one that the
+// document is what lexing and parsing the edited text from scratch gives.
+#include "../src/arena.hpp"
+#include "../src/lexer.cpp"
+#include "../src/parser.cpp"
+#include "../src/incremental.cpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+// Pieces of source to build documents and edits from, so that edits mostly
+// keep the text lexing and parsing, and now and then break it.
+static const char* const fragments[] = {
+    "def f(a b) a+b\n", "extern g(x);\n", "f(1, 2)\n", "x*(y-1) < 3;\n", "def h() 4\n",
+    "def", "extern", "f", "xy", "1", "2.5", "(", ")", ",", "+", "-", "*", "<", ";", " ", "\n",
+    "# note\n", "#", "@", "def k(n) k(n-1)*n\n",
+};
+constexpr usize fragmentCount = sizeof(fragments) / sizeof(fragments[0]);
+
+static std::string random_source(std::mt19937& rng, usize items) {
+    std::string src;
+    for (usize i = 0; i < items; i++) {
+        src += fragments[rng() % 5];
+        if (rng() % 8 == 0) {
+            src += fragments[20 + rng() % 2];
+        }
+    }
+    return src;
+}
+
+static Edit random_edit(std::mt19937& rng, const std::string& src) {
+    Edit edit;
+    edit.start = src.empty() ? 0 : rng() % (src.size() + 1);
+    edit.length = 0;
+    switch (rng() % 4) {
+    case 0: // delete
+        edit.length = std::min<usize>(rng() % 24, src.size() - edit.start);
+        break;
+    case 1: // replace
+        edit.length = std::min<usize>(rng() % 4, src.size() - edit.start);
+        [[fallthrough]];
+    default: // insert
+        for (u32 n = 1 + rng() % 2; n > 0; n--) {
+            edit.text += fragments[rng() % fragmentCount];
+        }
+    }
+    return edit;
+}
+
+static bool same_items(const Item& a, const Item& b) {
+    return a.tag == b.tag && a.tokBegin == b.tokBegin && a.tokEnd == b.tokEnd && a.proto == b.proto
+        && a.paramCount == b.paramCount && a.exprBegin == b.exprBegin && a.exprEnd == b.exprEnd && a.body == b.body;
+}
+
+static bool same_exprs(const Expr& a, const Expr& b) {
+    return a.tag == b.tag && a.token == b.token && a.lhs == b.lhs && a.rhs == b.rhs;
+}
+
+// The first difference between the document and a full parse of `src`,
+// or nullptr.
+static const char* check_document(const Document& doc, const std::string& src) {
+    DocumentSnapshot snap = document_snapshot(doc);
+    if (snap.src != src || doc.bytes != src.size()) {
+        return "text";
+    }
+    std::pmr::vector<Token> tokens = lex(src, std::pmr::get_default_resource());
+    if (snap.tokens.size() != tokens.size()) {
+        return "token count";
+    }
+    for (usize i = 0; i < tokens.size(); i++) {
+        if (snap.tokens[i].tag != tokens[i].tag || snap.tokens[i].start != tokens[i].start) {
+            return "tokens";
+        }
+    }
+    Program program = parse_program(tokens);
+    const Program& got = snap.program;
+    if ((got.error == nullptr) != (program.error == nullptr) || (program.error && (strcmp(got.error, program.error) != 0 || got.errorToken != program.errorToken))) {
+        return "error";
+    }
+    if (got.items.size() != program.items.size()) {
+        return "item count";
+    }
+    for (usize i = 0; i < program.items.size(); i++) {
+        if (!same_items(got.items[i], program.items[i])) {
+            return "items";
+        }
+    }
+    // After an error, the full parse also holds the nodes of the item that
+    // failed.
+    const usize exprCount = program.items.empty() ? 0 : program.items.back().exprEnd;
+    if (got.exprs.size() != exprCount) {
+        return "node count";
+    }
+    for (usize i = 0; i < exprCount; i++) {
+        if (!same_exprs(got.exprs[i], program.exprs[i])) {
+            return "nodes";
+        }
+    }
+    return nullptr;
+}
+
+int main(int argc, char** argv) {
+    const u32 seeds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 40;
+    const u32 editsPerSeed = argc > 2 ? strtoul(argv[2], nullptr, 10) : 500;
+    u64 edits = 0;
+    for (u32 seed = 0; seed < seeds; seed++) {
+        std::mt19937 rng(seed);
+        // Some documents span several segment blocks.
+        std::string src = random_source(rng, seed % 4 == 0 ? 400 : rng() % 40);
+        Document doc = open_document(src);
+        if (const char* diff = check_document(doc, src)) {
+            fprintf(stderr, "seed %u: open_document: %s differ\n", seed, diff);
+            return 1;
+        }
+        for (u32 i = 0; i < editsPerSeed; i++, edits++) {
+            const Edit edit = random_edit(rng, src);
+            src.replace(edit.start, edit.length, edit.text);
+            apply_edit(doc, edit);
+            if (const char* diff = check_document(doc, src)) {
+                fprintf(stderr, "seed %u, edit %u (%zu:%zu:\"%s\"): %s differ\n", seed, i, edit.start, edit.length, edit.text.c_str(), diff);
+                return 1;
+            }
+        }
+    }
+    printf("incremental: %llu edits match a full parse\n", (unsigned long long)edits);
+    return 0;
+}